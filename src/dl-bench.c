@@ -0,0 +1,398 @@
+/*
+ * Benchmarks the phases of listing a synthetic directory, built in a tmpfs.
+ * The whole of dl is included, so each phase can be timed on its own.
+ */
+#define main runDL
+#include "dl.c"
+#undef main
+
+#if tmk_IS_OPERATING_SYSTEM_WINDOWS
+#error "dl-bench is only available for Linux and MacOS."
+#endif
+
+#define BENCH_DEFAULT_PARENT_PATH "/dev/shm"
+#define BENCH_DEFAULT_TOTAL_ENTRIES 100000
+#define BENCH_DEFAULT_NAME_LENGTH 16
+#define BENCH_MAXIMUM_TOTAL_ENTRIES 10000000
+#define BENCH_MAXIMUM_NAME_LENGTH 255
+#define BENCH_FIRST_OWNER_ID 100000
+#define BENCH_NAME_ID_LENGTH 5
+
+struct BenchOptions {
+  const char *parentPath;
+  size_t totalEntries;
+  size_t minimumNameLength;
+  size_t maximumNameLength;
+  double symlinkRatio;
+  unsigned long totalOwners;
+  unsigned long totalRuns;
+  uint64_t seed;
+  int isKept;
+  int isSortBaseline;
+};
+
+struct BenchPhases {
+  double scan;
+  double stat;
+  double credentials;
+  double sort;
+  double render;
+};
+
+static unsigned long long parseBenchNumber(const char *option,
+                                           const char *value,
+                                           unsigned long long minimum,
+                                           unsigned long long maximum);
+static double parseBenchRatio(const char *value);
+static void parseBenchNameLengths(struct BenchOptions *options,
+                                  const char *value);
+static uint64_t generateRandom(uint64_t *state);
+static double measureTime(void);
+static void generateName(struct BenchOptions *options, uint64_t *state,
+                         size_t index, char *name);
+static char *generateTree(struct BenchOptions *options);
+static void removeTree(const char *path);
+static void resetBenchCredentials(void);
+static int compareBaselineEntries(const void *entryI, const void *entryII);
+static void runBench(struct BenchOptions *options, const char *path,
+                     struct BenchPhases *phases);
+static void writeBenchResult(struct BenchOptions *options, unsigned long run,
+                             struct BenchPhases *phases);
+static void writeBenchHelpPage(void);
+
+static unsigned long long parseBenchNumber(const char *option,
+                                           const char *value,
+                                           unsigned long long minimum,
+                                           unsigned long long maximum) {
+  char *end;
+  unsigned long long number = strtoull(value, &end, 10);
+  if (!*value || *end || *value == '-' || number < minimum ||
+      number > maximum) {
+    throwError("the value \"%s\" of --%s is not valid. It must be between "
+               "%llu and %llu.",
+               value, option, minimum, maximum);
+  }
+  return number;
+}
+
+static double parseBenchRatio(const char *value) {
+  char *end;
+  double ratio = strtod(value, &end);
+  if (!*value || *end || !(ratio >= 0 && ratio <= 1)) {
+    throwError("the value \"%s\" is not a valid symlink ratio. It must be "
+               "between 0 and 1.",
+               value);
+  }
+  return ratio;
+}
+
+static void parseBenchNameLengths(struct BenchOptions *options,
+                                  const char *value) {
+  /* Lengths are given as a single one or as a range, like 8:32. */
+  const char *separator = strchr(value, ':');
+  char minimum[24];
+  size_t minimumLength =
+      separator ? (size_t)(separator - value) : strlen(value);
+  if (minimumLength >= sizeof(minimum)) {
+    throwError("the value \"%s\" is not a valid name length.", value);
+  }
+  memcpy(minimum, value, minimumLength);
+  minimum[minimumLength] = 0;
+  options->minimumNameLength =
+      parseBenchNumber("name-length", minimum, BENCH_NAME_ID_LENGTH,
+                       BENCH_MAXIMUM_NAME_LENGTH);
+  options->maximumNameLength =
+      separator ? parseBenchNumber("name-length", separator + 1,
+                                   options->minimumNameLength,
+                                   BENCH_MAXIMUM_NAME_LENGTH)
+                : options->minimumNameLength;
+}
+
+static uint64_t generateRandom(uint64_t *state) {
+  /* xorshift64*, so the same seed always builds the same tree. */
+  *state ^= *state >> 12;
+  *state ^= *state << 25;
+  *state ^= *state >> 27;
+  return *state * 2685821657736338717ULL;
+}
+
+static double measureTime(void) {
+  struct timespec time;
+  clock_gettime(CLOCK_MONOTONIC, &time);
+  return time.tv_sec + time.tv_nsec / 1e9;
+}
+
+static void generateName(struct BenchOptions *options, uint64_t *state,
+                         size_t index, char *name) {
+  /* The index in base 36 keeps names unique without a common prefix. */
+  size_t length = options->minimumNameLength +
+                  generateRandom(state) % (options->maximumNameLength -
+                                           options->minimumNameLength + 1);
+  size_t offset = length;
+  for (size_t id = index, digit = 0; digit < BENCH_NAME_ID_LENGTH;
+       ++digit, id /= 36) {
+    name[--offset] = "0123456789abcdefghijklmnopqrstuvwxyz"[id % 36];
+  }
+  while (offset) {
+    name[--offset] = 'a' + generateRandom(state) % 26;
+  }
+  name[length] = 0;
+}
+
+static char *generateTree(struct BenchOptions *options) {
+  char *path = allocateHeapMemory(PATH_MAX);
+  snprintf(path, PATH_MAX, "%s/dl-bench.XXXXXX", options->parentPath);
+  if (!mkdtemp(path)) {
+    throwError("can not create a directory in \"%s\".", options->parentPath);
+  }
+  int directoryDescriptor = open(path, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+  if (directoryDescriptor < 0) {
+    throwError("can not open the directory \"%s\".", path);
+  }
+  /* Owners are only changed by root, others get a single one. */
+  int isChangingOwners = options->totalOwners > 1 && !geteuid();
+  if (options->totalOwners > 1 && !isChangingOwners) {
+    writeError("only root can give entries many owners, using one instead.");
+    exitCode_g = 0;
+  }
+  uint64_t state = options->seed;
+  char name[BENCH_MAXIMUM_NAME_LENGTH + 1];
+  char target[BENCH_MAXIMUM_NAME_LENGTH + 1];
+  for (size_t index = 0; index < options->totalEntries; ++index) {
+    generateName(options, &state, index, name);
+    int isSymlink =
+        generateRandom(&state) % 1000000 < options->symlinkRatio * 1000000;
+    if (isSymlink) {
+      generateName(options, &state, generateRandom(&state) % (index + 1),
+                   target);
+    }
+    int descriptor = -1;
+    if (isSymlink ? symlinkat(target, directoryDescriptor, name)
+                  : (descriptor = openat(directoryDescriptor, name,
+                                         O_WRONLY | O_CREAT | O_EXCL |
+                                             O_CLOEXEC,
+                                         0644)) < 0) {
+      throwError("can not create the entry \"%s\" in \"%s\".", name, path);
+    }
+    if (descriptor >= 0) {
+      close(descriptor);
+    }
+    if (isChangingOwners) {
+      unsigned int id = BENCH_FIRST_OWNER_ID + index % options->totalOwners;
+      fchownat(directoryDescriptor, name, id, id, AT_SYMLINK_NOFOLLOW);
+    }
+  }
+  close(directoryDescriptor);
+  return path;
+}
+
+static void removeTree(const char *path) {
+  DIR *directory = opendir(path);
+  if (!directory) {
+    return;
+  }
+  int directoryDescriptor = dirfd(directory);
+  for (struct dirent *entry; (entry = readdir(directory));) {
+    if (strcmp(entry->d_name, ".") && strcmp(entry->d_name, "..")) {
+      unlinkat(directoryDescriptor, entry->d_name, 0);
+    }
+  }
+  closedir(directory);
+  rmdir(path);
+}
+
+static void resetBenchCredentials(void) {
+  /* Each run looks owners up again, instead of hitting the last one's. */
+  struct CredentialTable *tables[] = {&userCredentialsTable_g,
+                                      &groupCredentialsTable_g};
+  for (size_t index = 0; index < 2; ++index) {
+    const char *databasePath = tables[index]->databasePath;
+    freeCredentialTable(tables[index]);
+    memset(tables[index], 0, sizeof(struct CredentialTable));
+    tables[index]->databasePath = databasePath;
+  }
+  resetArenaAllocator(userCredentialsAllocator_g);
+  resetArenaAllocator(userCredentialsDataAllocator_g);
+  resetArenaAllocator(groupCredentialsAllocator_g);
+  resetArenaAllocator(groupCredentialsDataAllocator_g);
+  workers_g->hasLastUser = 0;
+  workers_g->hasLastGroup = 0;
+}
+
+static const char *baselineNames_g = NULL;
+
+static int compareBaselineEntries(const void *entryI, const void *entryII) {
+  return strcmp(baselineNames_g + ((struct Entry *)entryI)->nameOffset,
+                baselineNames_g + ((struct Entry *)entryII)->nameOffset);
+}
+
+static void runBench(struct BenchOptions *options, const char *path,
+                     struct BenchPhases *phases) {
+  /* Mirrors readDirectory with a single worker, timing each phase. */
+  struct Listing listing = {.directoryPath = path,
+                            .isPathResolved = 1,
+                            .output = {.isDeferred = 1}};
+  struct Worker *worker = workers_g;
+  struct DirectoryScanner scanner;
+  memset(phases, 0, sizeof(struct BenchPhases));
+  double scanStart = measureTime();
+  if (openListing(&listing, worker, AT_FDCWD, path, &scanner)) {
+    throwError(listing.errorFormat, path);
+  }
+  resetColumnLengths(worker, 1);
+  for (;; scanStart = measureTime()) {
+    size_t totalRecords =
+        scanDirectoryBatch(worker, &scanner, DIRECTORY_BATCH_CAPACITY);
+    double statStart = measureTime();
+    phases->scan += statStart - scanStart;
+    if (!totalRecords) {
+      break;
+    }
+    statDirectoryRecords(worker, scanner.descriptor, worker->records,
+                         totalRecords);
+    double credentialsStart = measureTime();
+    phases->stat += credentialsStart - statStart;
+    saveDirectoryRecords(worker, scanner.descriptor, worker->records,
+                         totalRecords);
+    phases->credentials += measureTime() - credentialsStart;
+  }
+  closeDirectoryScanner(&scanner);
+  listing.userColumnLength = worker->userColumnLength;
+  listing.groupColumnLength = worker->groupColumnLength;
+  listing.sizeColumnLength = worker->sizeColumnLength;
+  listing.totalEntries = worker->entriesAllocator->use;
+  listing.entries = compactArenaAllocator(worker->entriesAllocator);
+  listing.names = compactArenaAllocator(worker->entriesDataAllocator);
+  double sortStart = measureTime();
+  if (options->isSortBaseline) {
+    /* The sort dl used before its radix one, to compare them against. */
+    baselineNames_g = listing.names;
+    qsort(listing.entries, listing.totalEntries, sizeof(struct Entry),
+          compareBaselineEntries);
+  } else {
+    sortEntries(listing.entries, listing.totalEntries, listing.names);
+  }
+  double renderStart = measureTime();
+  phases->sort = renderStart - sortStart;
+  formatListing(&listing, worker);
+  phases->render = measureTime() - renderStart;
+  free(listing.output.buffer);
+  resetArenaAllocator(entriesAllocator_g);
+  resetArenaAllocator(entriesDataAllocator_g);
+}
+
+static void writeBenchResult(struct BenchOptions *options, unsigned long run,
+                             struct BenchPhases *phases) {
+  /* One JSON object for each run, in seconds, bytes and entries per second. */
+  struct rusage usage;
+  getrusage(RUSAGE_SELF, &usage);
+#if defined(__APPLE__)
+  unsigned long long peakRSS = usage.ru_maxrss;
+#else
+  unsigned long long peakRSS = usage.ru_maxrss * 1024ULL;
+#endif
+  double total = phases->scan + phases->stat + phases->credentials +
+                 phases->sort + phases->render;
+  tmk_writeLine("{\"run\":%lu,\"entries\":%zu,\"scan\":%.6f,\"stat\":%.6f,"
+                "\"credentials\":%.6f,\"sort\":%.6f,\"render\":%.6f,"
+                "\"total\":%.6f,\"entriesPerSecond\":%.0f,\"peakRSS\":%llu}",
+                run, options->totalEntries, phases->scan, phases->stat,
+                phases->credentials, phases->sort, phases->render, total,
+                total > 0 ? options->totalEntries / total : 0, peakRSS);
+}
+
+static void writeBenchHelpPage(void) {
+  tmk_writeLine("Usage: dl-bench [OPTIONS]...");
+  tmk_writeLine("Builds a synthetic directory and times each phase of listing "
+                "it, writing one");
+  tmk_writeLine("JSON object for each run.");
+  tmk_writeLine("");
+  tmk_writeLine("OPTIONS");
+  tmk_writeLine("    --help               Shows the software help "
+                "instructions.");
+  tmk_writeLine("    --dir PATH           Builds the directory inside PATH, "
+                "/dev/shm by default.");
+  tmk_writeLine("    --entries N          Sets the number of entries, from 1 "
+                "to 10000000.");
+  tmk_writeLine("                         The default is 100000.");
+  tmk_writeLine("    --name-length N[:M]  Sets the length of names, or a range "
+                "to pick from");
+  tmk_writeLine("                         uniformly. The default is 16.");
+  tmk_writeLine("    --symlinks R         Sets the ratio of entries that are "
+                "symlinks, from 0 to 1.");
+  tmk_writeLine("    --owners N           Spreads entries over N owners, "
+                "needing root.");
+  tmk_writeLine("    --runs N             Sets the number of runs. Each one "
+                "starts with no owners");
+  tmk_writeLine("                         known, but finds the directory in "
+                "the page and dentry");
+  tmk_writeLine("                         caches, as it was just built.");
+  tmk_writeLine("    --seed N             Sets the seed for the names.");
+  tmk_writeLine("    --sort-baseline      Sorts by name with qsort and "
+                "strcmp instead, to compare");
+  tmk_writeLine("                         the sort phase against it.");
+  tmk_writeLine("    --keep               Keeps the directory built.");
+}
+
+int main(int totalRawCMDArguments, const char **rawCMDArguments) {
+  struct tmk_CmdArguments cmdArguments;
+  tmk_getCmdArguments(totalRawCMDArguments, rawCMDArguments, &cmdArguments);
+  struct BenchOptions options = {.parentPath = BENCH_DEFAULT_PARENT_PATH,
+                                 .totalEntries = BENCH_DEFAULT_TOTAL_ENTRIES,
+                                 .minimumNameLength =
+                                     BENCH_DEFAULT_NAME_LENGTH,
+                                 .maximumNameLength =
+                                     BENCH_DEFAULT_NAME_LENGTH,
+                                 .totalOwners = 1,
+                                 .totalRuns = 3,
+                                 .seed = 1};
+  for (int offset = 1; offset < cmdArguments.totalArguments; ++offset) {
+    const char *optionValue;
+    PARSE_OPTION("help", writeBenchHelpPage());
+    PARSE_FLAG("keep", options.isKept = 1);
+    PARSE_FLAG("sort-baseline", options.isSortBaseline = 1);
+    PARSE_VALUE_OPTION("dir", options.parentPath = optionValue);
+    PARSE_VALUE_OPTION("entries", options.totalEntries = parseBenchNumber(
+                                      "entries", optionValue, 1,
+                                      BENCH_MAXIMUM_TOTAL_ENTRIES));
+    PARSE_VALUE_OPTION("name-length",
+                       parseBenchNameLengths(&options, optionValue));
+    PARSE_VALUE_OPTION("symlinks",
+                       options.symlinkRatio = parseBenchRatio(optionValue));
+    PARSE_VALUE_OPTION("owners", options.totalOwners = parseBenchNumber(
+                                     "owners", optionValue, 1, UINT32_MAX));
+    PARSE_VALUE_OPTION("runs", options.totalRuns = parseBenchNumber(
+                                   "runs", optionValue, 1, 1000));
+    PARSE_VALUE_OPTION("seed", options.seed = parseBenchNumber(
+                                   "seed", optionValue, 1, ULLONG_MAX));
+    throwError("the option \"%s\" does not exist. Use --help for help "
+               "instructions.",
+               cmdArguments.utf8Arguments[offset]);
+  }
+  char *path = generateTree(&options);
+  createAllocators();
+  for (unsigned long run = 1; run <= options.totalRuns; ++run) {
+    struct BenchPhases phases;
+    resetBenchCredentials();
+    runBench(&options, path, &phases);
+    writeBenchResult(&options, run, &phases);
+  }
+  if (options.isKept) {
+    tmk_writeError("Kept the directory \"%s\".\n", path);
+  } else {
+    removeTree(path);
+  }
+  free(path);
+  freeWorkers();
+  freeArenaAllocator(userCredentialsAllocator_g);
+  freeArenaAllocator(userCredentialsDataAllocator_g);
+  freeArenaAllocator(groupCredentialsAllocator_g);
+  freeArenaAllocator(groupCredentialsDataAllocator_g);
+  freeCredentialTable(&userCredentialsTable_g);
+  freeCredentialTable(&groupCredentialsTable_g);
+  freeArenaAllocator(entriesAllocator_g);
+  freeArenaAllocator(entriesDataAllocator_g);
+  freeArenaAllocator(temporaryDataAllocator_g);
+  tmk_freeCmdArguments(&cmdArguments);
+  return exitCode_g;
+}
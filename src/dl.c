@@ -1,3 +1,7 @@
+#if defined(__linux__)
+#define _GNU_SOURCE
+#endif
+#include <stdint.h>
 #include <stdio.h>
 #include <string.h>
 #include <time.h>
@@ -6,10 +10,33 @@
 #include <Windows.h>
 #else
 #include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <fnmatch.h>
 #include <grp.h>
+#include <limits.h>
+#include <poll.h>
+#include <pthread.h>
 #include <pwd.h>
+#include <regex.h>
+#include <sched.h>
+#include <signal.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <sys/resource.h>
 #include <sys/stat.h>
 #include <unistd.h>
+#if defined(__linux__)
+#include <sys/inotify.h>
+#include <sys/syscall.h>
+#include <sys/sysmacros.h>
+#if defined(__has_include)
+#if __has_include(<linux/io_uring.h>)
+#include <linux/io_uring.h>
+#define HAS_IO_URING true
+#endif
+#endif
+#endif
 #endif
 
 #define SOFTWARE_NAME "dl"
@@ -31,7 +58,125 @@
     action_a;                                                                  \
     return 0;                                                                  \
   }
+#define PARSE_FLAG(option_a, action_a)                                         \
+  if (!strcmp(cmdArguments.utf8Arguments[offset], "--" option_a)) {            \
+    action_a;                                                                  \
+    continue;                                                                  \
+  }
+#define PARSE_VALUE_OPTION(option_a, action_a)                                 \
+  if ((optionValue = getOptionValue(&cmdArguments, "--" option_a, &offset))) { \
+    action_a;                                                                  \
+    continue;                                                                  \
+  }
 #define DEBUG false
+#define USE_HUGE_PAGES true
+#define ARENA_BLOCK_HEADER_SIZE                                                \
+  ((sizeof(struct ArenaBlock) + 15) & ~(size_t)15)
+#define ARENA_MAPPING_THRESHOLD 1048576
+#define HUGE_PAGE_SIZE 2097152
+#define DIRECTORY_BUFFER_SIZE 262144
+#define DIRECTORY_BATCH_CAPACITY 4096
+#define STREAM_BATCH_CAPACITY 256
+#define IO_URING_CAPACITY 256
+#define WORKER_CHUNK_SIZE 64
+#define MAXIMUM_TOTAL_WORKERS 256
+#define DEFAULT_LISTINGS_IN_FLIGHT 4
+#define CREDENTIAL_TABLE_INITIAL_CAPACITY 64
+#define CREDENTIAL_CHUNK_CAPACITY 1024
+#define CREDENTIAL_CHUNKS_INITIAL_CAPACITY 16
+#define CREDENTIALS_PRELOAD_THRESHOLD 64
+#define OUTPUT_BUFFER_SIZE 262144
+#define SIZE_BUFFER_SIZE 24
+#define DATE_CACHE_CAPACITY 64
+#define UTC_OFFSET_SEGMENTS_CAPACITY 4
+#define UTC_OFFSET_MAXIMUM_GAP 604800
+#define TREE_UNWRITTEN_OUTPUT_LIMIT 67108864
+#define INODE_SET_INITIAL_CAPACITY 64
+#define WATCH_ENTRIES_INITIAL_CAPACITY 64
+#define WATCH_NAMES_INITIAL_CAPACITY 4096
+#define WATCH_EVENTS_BUFFER_SIZE 65536
+#define WATCH_SLOTS_INITIAL_CAPACITY 128
+#define WATCH_FREE_SLOT UINT32_MAX
+#define WATCH_HEADER_ROWS 3
+#define TOTAL_STATS_PHASES 7
+#define ARENA_STATS_CAPACITY 16
+/* "DLCACHE" read as a little endian integer. */
+#define CACHE_MAGIC 0x45484341434c44ULL
+#define CACHE_VERSION 3
+#define CACHE_ABSENT_OFFSET UINT32_MAX
+#define UNKNOWN_ID UINT_MAX
+#define UNKNOWN_CREDENTIAL UINT32_MAX
+#define SECONDS_PER_DAY 86400
+#define SORT_INSERTION_THRESHOLD 32
+#define TOP_ENTRIES_INITIAL_CAPACITY 64
+#define ANSI_DARK_RED "\x1b[31m"
+#define ANSI_DARK_GREEN "\x1b[32m"
+#define ANSI_DARK_YELLOW "\x1b[33m"
+#define ANSI_DARK_BLUE "\x1b[34m"
+#define ANSI_DARK_MAGENTA "\x1b[35m"
+#define ANSI_DARK_CYAN "\x1b[36m"
+#define ANSI_RESET_COLORS "\x1b[39m"
+#define ANSI_BOLD "\x1b[1m"
+#define ANSI_RESET_WEIGHT "\x1b[22m"
+#define SELECT_0(zero_a, other_a) zero_a
+#define SELECT_1(zero_a, other_a) other_a
+#define SELECT_2(zero_a, other_a) other_a
+#define SELECT_3(zero_a, other_a) other_a
+#define SELECT_4(zero_a, other_a) other_a
+#define SELECT_5(zero_a, other_a) other_a
+#define SELECT_6(zero_a, other_a) other_a
+#define SELECT_7(zero_a, other_a) other_a
+#define COLORED_READ ANSI_DARK_RED "r"
+#define COLORED_WRITE ANSI_DARK_GREEN "w"
+#define COLORED_EXECUTE ANSI_DARK_YELLOW "x"
+#define COLORED_NONE ANSI_RESET_COLORS "-"
+#define COLORED_TRIAD_0 COLORED_NONE COLORED_NONE COLORED_NONE
+#define COLORED_TRIAD_1 COLORED_NONE COLORED_NONE COLORED_EXECUTE
+#define COLORED_TRIAD_2 COLORED_NONE COLORED_WRITE COLORED_NONE
+#define COLORED_TRIAD_3 COLORED_NONE COLORED_WRITE COLORED_EXECUTE
+#define COLORED_TRIAD_4 COLORED_READ COLORED_NONE COLORED_NONE
+#define COLORED_TRIAD_5 COLORED_READ COLORED_NONE COLORED_EXECUTE
+#define COLORED_TRIAD_6 COLORED_READ COLORED_WRITE COLORED_NONE
+#define COLORED_TRIAD_7 COLORED_READ COLORED_WRITE COLORED_EXECUTE
+#define PLAIN_TRIAD_0 "---"
+#define PLAIN_TRIAD_1 "--x"
+#define PLAIN_TRIAD_2 "-w-"
+#define PLAIN_TRIAD_3 "-wx"
+#define PLAIN_TRIAD_4 "r--"
+#define PLAIN_TRIAD_5 "r-x"
+#define PLAIN_TRIAD_6 "rw-"
+#define PLAIN_TRIAD_7 "rwx"
+/* The octal text of the permissions, left aligned in 3 columns. */
+#define OCTAL_PERMISSIONS(user_a, group_a, others_a)                           \
+  SELECT_##user_a(SELECT_##group_a(#others_a "  ", #group_a #others_a " "),    \
+                  #user_a #group_a #others_a)
+#define COLORED_PERMISSIONS(user_a, group_a, others_a)                         \
+  COLORED_TRIAD_##user_a COLORED_TRIAD_##group_a COLORED_TRIAD_##others_a      \
+      ANSI_DARK_MAGENTA " " OCTAL_PERMISSIONS(user_a, group_a, others_a) " "
+#define PLAIN_PERMISSIONS(user_a, group_a, others_a)                           \
+  PLAIN_TRIAD_##user_a PLAIN_TRIAD_##group_a PLAIN_TRIAD_##others_a " "        \
+      OCTAL_PERMISSIONS(user_a, group_a, others_a) " "
+#define PERMISSIONS(user_a, group_a, others_a)                                 \
+  {COLORED_PERMISSIONS(user_a, group_a, others_a),                             \
+   PLAIN_PERMISSIONS(user_a, group_a, others_a),                               \
+   OCTAL_PERMISSIONS(user_a, group_a, others_a),                               \
+   sizeof(COLORED_PERMISSIONS(user_a, group_a, others_a)) - 1}
+#define GROUP_PERMISSIONS(user_a, group_a)                                     \
+  PERMISSIONS(user_a, group_a, 0), PERMISSIONS(user_a, group_a, 1),            \
+      PERMISSIONS(user_a, group_a, 2), PERMISSIONS(user_a, group_a, 3),        \
+      PERMISSIONS(user_a, group_a, 4), PERMISSIONS(user_a, group_a, 5),        \
+      PERMISSIONS(user_a, group_a, 6), PERMISSIONS(user_a, group_a, 7)
+#define USER_PERMISSIONS(user_a)                                               \
+  GROUP_PERMISSIONS(user_a, 0), GROUP_PERMISSIONS(user_a, 1),                  \
+      GROUP_PERMISSIONS(user_a, 2), GROUP_PERMISSIONS(user_a, 3),              \
+      GROUP_PERMISSIONS(user_a, 4), GROUP_PERMISSIONS(user_a, 5),              \
+      GROUP_PERMISSIONS(user_a, 6), GROUP_PERMISSIONS(user_a, 7)
+#define PERMISSIONS_PLAIN_LENGTH 14
+#if defined(STATX_TYPE)
+#define ENTRY_STATX_MASK                                                       \
+  (STATX_TYPE | STATX_MODE | STATX_UID | STATX_GID | STATX_SIZE |             \
+   STATX_MTIME | STATX_BLOCKS | STATX_INO | STATX_NLINK)
+#endif
 #define SAVE_GREATER(buffer_a, value_a)                                        \
   if (value_a > buffer_a) {                                                    \
     buffer_a = value_a;                                                        \
@@ -42,11 +187,6 @@ struct String {
   size_t length;
 };
 
-struct SIMultiplier {
-  float value;
-  char prefix;
-};
-
 #if defined(_WIN32)
 struct Credential {
   struct String user;
@@ -56,34 +196,483 @@ struct Credential {
 
 struct Entry {
   char *name;
-  char *size;
   struct Credential *credential;
+  unsigned long long size;
   FILETIME modifiedTime;
   DWORD mode;
+  int hasSize;
 };
 #else
 struct Credential {
   struct String name;
   uid_t id;
+  uint32_t index;
+};
+
+struct CredentialChunks {
+  struct CredentialChunks *previous;
+  size_t capacity;
+  struct Credential **chunks[];
+};
+
+struct CredentialTable {
+  struct Credential **slots;
+  struct CredentialChunks *chunks;
+  const char *databasePath;
+  size_t use;
+  size_t capacity;
+  int isPreloaded;
+};
+
+enum CredentialsMode {
+  CredentialsMode_Automatic,
+  CredentialsMode_Preload,
+  CredentialsMode_Lookup
+};
+
+enum SortKind {
+  SortKind_Name,
+  SortKind_Size,
+  SortKind_ModifiedTime,
+  SortKind_Version
+};
+
+enum OutputFormat {
+  OutputFormat_Table,
+  OutputFormat_JSONLines,
+  OutputFormat_CSV,
+  OutputFormat_TSV,
+  OutputFormat_NUL
+};
+
+enum StatsFormat {
+  StatsFormat_None,
+  StatsFormat_Text,
+  StatsFormat_JSON
+};
+
+enum StatsPhase {
+  StatsPhase_Readdir,
+  StatsPhase_Stat,
+  StatsPhase_Readlink,
+  StatsPhase_Credentials,
+  StatsPhase_Sort,
+  StatsPhase_Render,
+  StatsPhase_Write
+};
+
+enum NamePatternKind {
+  NamePatternKind_Literal,
+  NamePatternKind_Prefix,
+  NamePatternKind_Suffix,
+  NamePatternKind_Infix,
+  NamePatternKind_Glob,
+  NamePatternKind_Regex
+};
+
+enum TreeNodeState {
+  TreeNodeState_Queued,
+  TreeNodeState_Claimed,
+  TreeNodeState_Done
 };
 
+/* Half a cache line, with offsets and indexes instead of pointers. */
 struct Entry {
-  char *name;
-  char *link;
-  char *size;
-  struct Credential *user;
-  struct Credential *group;
+  unsigned long long size;
+  time_t modifiedTime;
+  uint32_t nameOffset;
+  uint32_t userIndex;
+  uint32_t groupIndex;
+  uint16_t mode;
+  uint16_t hasSize;
+};
+
+#if defined(__linux__)
+struct LinuxDirectoryEntry {
+  uint64_t inode;
+  int64_t offset;
+  unsigned short size;
+  unsigned char type;
+  char name[];
+};
+#endif
+
+struct DirectoryScanner {
+  int descriptor;
+  char *buffer;
+  size_t offset;
+  size_t length;
+  int isFiltered;
+#if !defined(__linux__)
+  DIR *stream;
+  struct dirent *pendingEntry;
+#endif
+};
+
+struct NamePattern {
+  const char *value;
+  char *literal;
+  size_t literalLength;
+  enum NamePatternKind kind;
+  int isExcluding;
+  regex_t regex;
+};
+
+#if defined(HAS_IO_URING)
+struct IOURing {
+  int descriptor;
+  unsigned int *submissionHead;
+  unsigned int *submissionTail;
+  unsigned int *submissionMask;
+  unsigned int *submissionArray;
+  struct io_uring_sqe *submissions;
+  unsigned int *completionHead;
+  unsigned int *completionTail;
+  unsigned int *completionMask;
+  struct io_uring_cqe *completions;
+  struct statx *stats;
+  void *submissionRing;
+  size_t submissionRingSize;
+  void *completionRing;
+  size_t completionRingSize;
+  size_t submissionsSize;
+};
+#endif
+
+struct DirectoryRecord {
+  const char *name;
+  size_t nameSize;
+  unsigned long long size;
+  unsigned long long allocatedSize;
   time_t modifiedTime;
+  dev_t device;
+  ino_t inode;
+  nlink_t totalLinks;
   mode_t mode;
+  uid_t userId;
+  gid_t groupId;
+  unsigned char type;
+  int isStated;
+};
+
+struct DateCacheSlot {
+  long long day;
+  char text[16];
+  int length;
+  int isUsed;
+};
+
+struct SortKey {
+  uint64_t key;
+  uint32_t nameOffset;
+  uint32_t index;
+};
+
+struct TopEntry {
+  struct Entry entry;
+  char *name;
+  char *link;
+  size_t nameCapacity;
+  size_t linkCapacity;
+};
+
+struct UTCOffsetSegment {
+  time_t start;
+  time_t end;
+  long utcOffset;
+};
+
+struct DateCache {
+  struct DateCacheSlot slots[DATE_CACHE_CAPACITY];
+  struct UTCOffsetSegment segments[UTC_OFFSET_SEGMENTS_CAPACITY];
+  int totalSegments;
+  int nextSegment;
 };
+
+struct StatsClock {
+  uint64_t wallTime;
+  uint64_t cpuTime;
+};
+
+struct PhaseStats {
+  uint64_t wallTime;
+  uint64_t cpuTime;
+  size_t totalCalls;
+};
+
+struct WorkerStats {
+  struct PhaseStats phases[TOTAL_STATS_PHASES];
+  size_t totalCredentialHits;
+  size_t totalCredentialLookups;
+};
+
+struct Worker {
+  pthread_t thread;
+  struct ArenaAllocator *entriesAllocator;
+  struct ArenaAllocator *entriesDataAllocator;
+  struct DirectoryRecord *records;
+  char *directoryBuffer;
+#if defined(HAS_IO_URING)
+  struct IOURing *ioURing;
 #endif
+  int isIOURingUnavailable;
+  uint32_t lastUser;
+  uint32_t lastGroup;
+  uid_t lastUserId;
+  gid_t lastGroupId;
+  int hasLastUser;
+  int hasLastGroup;
+  int userColumnLength;
+  int groupColumnLength;
+  int sizeColumnLength;
+  struct TopEntry *topEntries;
+  size_t totalTopEntries;
+  size_t topEntriesCapacity;
+  struct DateCache dateCache;
+  struct WorkerStats stats;
+};
 
-struct ArenaAllocator {
+struct WorkerPool {
+  pthread_mutex_t mutex;
+  pthread_cond_t workCondition;
+  pthread_cond_t doneCondition;
+  struct DirectoryRecord *records;
+  size_t totalRecords;
+  size_t nextRecord;
+  unsigned long generation;
+  int directoryDescriptor;
+  int areRecordsStated;
+  int totalBusyWorkers;
+  int isExiting;
+};
+
+struct Permissions {
+  const char *colored;
+  const char *plain;
+  const char *octal;
+  size_t coloredLength;
+};
+
+struct EntryType {
+  const char *escape;
+  const char *icon;
+  const char *letter;
+  const char *name;
+};
+
+struct OutputBuffer {
+  char *buffer;
+  size_t use;
+  size_t capacity;
+  int isDeferred;
+};
+
+struct Listing {
+  const char *directoryPath;
+  const char *errorFormat;
+  struct Entry *entries;
+  const char *names;
+  size_t totalEntries;
+  int userColumnLength;
+  int groupColumnLength;
+  int sizeColumnLength;
+  int indexColumnLength;
+  int isScanned;
+  int isPathResolved;
+  struct OutputBuffer output;
+};
+
+struct ListingQueue {
+  pthread_mutex_t mutex;
+  pthread_cond_t condition;
+  struct Listing *listings;
+  struct Worker *workers;
+  int totalListings;
+  int nextListing;
+  int totalWritten;
+  int totalInFlight;
+};
+
+struct TreeNode {
+  struct TreeNode *parent;
+  struct TreeNode *children;
+  struct TreeNode *previousQueued;
+  struct TreeNode *nextQueued;
+  char *path;
+  const char *name;
+  size_t totalChildren;
+  size_t totalUnopenedChildren;
+  dev_t device;
+  ino_t inode;
+  int descriptor;
+  int depth;
+  int queue;
+  enum TreeNodeState state;
+  struct Listing listing;
+};
+
+struct TreeQueue {
+  struct TreeNode *head;
+  struct TreeNode *tail;
+};
+
+struct DirectorySize {
+  unsigned long long apparentSize;
+  unsigned long long allocatedSize;
+};
+
+struct InodeKey {
+  const struct DirectorySize *size;
+  dev_t device;
+  ino_t inode;
+};
+
+struct SizeMeasure {
+  struct DirectorySize *sizes;
+  struct InodeKey *inodes;
+  size_t totalInodes;
+  size_t inodesCapacity;
+  size_t totalPendingTasks;
+  int directoryDescriptor;
+};
+
+struct SizeTask {
+  struct SizeTask *parent;
+  struct SizeTask *previousQueued;
+  struct SizeTask *nextQueued;
+  struct SizeMeasure *measure;
+  struct DirectorySize *size;
+  size_t totalReferences;
+  size_t totalUnopenedChildren;
+  dev_t device;
+  int descriptor;
+  int queue;
+  char name[];
+};
+
+struct SizeQueue {
+  struct SizeTask *head;
+  struct SizeTask *tail;
+};
+
+struct SizeWalk {
+  pthread_mutex_t mutex;
+  pthread_cond_t workCondition;
+  pthread_cond_t doneCondition;
+  struct SizeQueue *queues;
+  struct Worker *workers;
+  size_t totalKeptDescriptors;
+  size_t maximumKeptDescriptors;
+  int totalWorkers;
+  int isExiting;
+};
+
+struct TreeWalk {
+  pthread_mutex_t mutex;
+  pthread_cond_t workCondition;
+  pthread_cond_t doneCondition;
+  struct TreeNode *roots;
+  struct TreeQueue *queues;
+  struct Worker *workers;
+  size_t totalUnwrittenBytes;
+  size_t totalKeptDescriptors;
+  size_t maximumKeptDescriptors;
+  int totalRoots;
+  int totalWorkers;
+  int isFinished;
+};
+
+struct CacheKey {
+  uint64_t device;
+  uint64_t inode;
+  int64_t modifiedSeconds;
+  int64_t modifiedNanoseconds;
+  int64_t changedSeconds;
+  int64_t changedNanoseconds;
+  uint64_t isSizeAllocated;
+};
+
+struct CacheHeader {
+  uint64_t magic;
+  uint32_t version;
+  uint32_t recordSize;
+  struct CacheKey key;
+  uint64_t totalRecords;
+  uint64_t dataSize;
+  uint64_t checksum;
+};
+
+struct CacheRecord {
+  uint64_t size;
+  int64_t modifiedTime;
+  uint32_t mode;
+  uint32_t hasSize;
+  uint32_t userId;
+  uint32_t groupId;
+  uint32_t nameOffset;
+  uint32_t linkOffset;
+};
+
+struct Watch {
+  struct Listing listing;
+  struct OutputBuffer screen;
+  struct Entry *entries;
+  struct Entry *slots;
+  char *names;
+  size_t totalEntries;
+  size_t entriesCapacity;
+  size_t slotsCapacity;
+  size_t namesSize;
+  size_t namesCapacity;
+  size_t totalUnusedNames;
+  int columnLengths[3];
+  size_t totalWidestEntries[3];
+  size_t firstChangedIndex;
+  size_t lastChangedIndex;
+  size_t totalDrawnEntries;
+  size_t totalDrawnRows;
+  int isRedrawNeeded;
+  int directoryDescriptor;
+  int notifyDescriptor;
+};
+
+struct ArenaStats {
   char *name;
+  size_t unit;
+  size_t totalAllocators;
+  size_t peakUse;
+  size_t peakCapacity;
+};
+
+struct Stats {
+  struct WorkerStats workers;
+  size_t totalTableCredentialHits;
+  size_t totalSystemCredentialLookups;
+  size_t totalPreloadedDatabases;
+  struct ArenaStats arenas[ARENA_STATS_CAPACITY];
+  size_t totalArenas;
+  uint64_t startTime;
+};
+#endif
+
+struct ArenaBlock {
+  struct ArenaBlock *previous;
   char *buffer;
   size_t use;
   size_t capacity;
+  size_t mappingSize;
+};
+
+struct ArenaAllocator {
+  char *name;
+  struct ArenaBlock *block;
+  struct ArenaBlock *spareBlock;
+  size_t use;
+  size_t capacity;
+  size_t nextBlockCapacity;
   size_t unit;
+  size_t peakUse;
+  size_t peakCapacity;
 };
 
 #if defined(DEBUG)
@@ -99,26 +688,272 @@ static struct Credential *findCredential(const wchar_t *utf16DirectoryPath,
 static void readDirectory(const char *utf8DirectoryPath,
                           const wchar_t *utf16DirectoryPath);
 #else
+static int openDirectoryScanner(int parentDescriptor, const char *directoryPath,
+                                char *buffer,
+                                struct DirectoryScanner *scanner);
+static size_t scanDirectoryBatch(struct Worker *worker,
+                                 struct DirectoryScanner *scanner,
+                                 size_t capacity);
+static void closeDirectoryScanner(struct DirectoryScanner *scanner);
+static void compileNamePatterns(void);
+static int matchNamePattern(const struct NamePattern *pattern,
+                            const char *name, size_t length);
+static int isNameIncluded(const char *name, size_t length);
+static int isScannedEntryIncluded(const char *name, size_t length,
+                                  unsigned char type);
+static void freeNamePatterns(void);
+static int statDirectoryRecord(int directoryDescriptor,
+                               struct DirectoryRecord *record);
+#if defined(STATX_TYPE)
+static void saveStatxData(const struct statx *entryStat,
+                          struct DirectoryRecord *record);
+#endif
+#if defined(HAS_IO_URING)
+static struct IOURing *createIOURing(void);
+static void freeIOURing(struct IOURing *ring);
+static size_t drainIOURing(struct IOURing *ring, size_t totalInFlight);
+static int statDirectoryRecordsAsynchronously(struct Worker *worker,
+                                              int directoryDescriptor,
+                                              struct DirectoryRecord *records,
+                                              size_t totalRecords,
+                                              size_t *totalCalls);
+#endif
+static void saveUnstatedDirectoryRecord(struct DirectoryRecord *record);
+static void statDirectoryRecordsSynchronously(int directoryDescriptor,
+                                               struct DirectoryRecord *records,
+                                               size_t totalRecords);
+static void statDirectoryRecords(struct Worker *worker,
+                                 int directoryDescriptor,
+                                 struct DirectoryRecord *records,
+                                 size_t totalRecords);
+static int isRecordIncluded(const struct DirectoryRecord *record);
+static void saveDirectoryRecords(struct Worker *worker,
+                                 int directoryDescriptor,
+                                 struct DirectoryRecord *records,
+                                 size_t totalRecords);
+static uint32_t saveEntryNames(struct ArenaAllocator *allocator,
+                               const char *name, size_t nameSize,
+                               const char *link);
+static const char *findEntryLink(const char *names, const struct Entry *entry);
+static size_t measureEntryNames(const char *names, const struct Entry *entry);
+static void saveColumnLengths(struct Worker *worker, struct Entry *entry);
+static int compareEntries(const struct Entry *entryI, const char *nameI,
+                          const struct Entry *entryII, const char *nameII);
+static char *copyToBuffer(char **buffer, size_t *capacity, const char *string,
+                          size_t size);
+static struct TopEntry *claimTopEntry(struct Worker *worker,
+                                      const struct Entry *candidate,
+                                      const char *name);
+static void saveTopDirectoryRecord(struct Worker *worker,
+                                   int directoryDescriptor,
+                                   struct DirectoryRecord *record);
+static void createWorkers(void);
+static void *runWorker(void *worker);
+static void runWorkerPoolChunks(struct Worker *worker);
+static void runWorkerPool(int directoryDescriptor,
+                          struct DirectoryRecord *records,
+                          size_t totalRecords);
+static void createWorkerBuffers(struct Worker *worker);
+static void freeWorkerBuffers(struct Worker *worker);
+static void freeWorkers(void);
+static struct Credential **findCredentialSlot(struct CredentialTable *table,
+                                              unsigned int id);
+static void growCredentialTable(struct CredentialTable *table);
+static void growCredentialChunks(struct CredentialTable *table);
+static void freeCredentialTable(struct CredentialTable *table);
+static struct Credential *saveCredential(int isUser, unsigned int id,
+                                         const char *name);
+static void loadCredentialsDatabase(int isUser, const char *path);
+static void preloadCredentials(int isUser);
 static struct Credential *findCredential(int isUser, unsigned int id);
+static uint32_t findWorkerCredential(struct Worker *worker, int isUser,
+                                     unsigned int id);
+static struct Credential *findIndexedCredential(int isUser, uint32_t index);
+static int openListing(struct Listing *listing, struct Worker *worker,
+                       int parentDescriptor, const char *directoryName,
+                       struct DirectoryScanner *scanner);
+static void resetColumnLengths(struct Worker *worker, int totalWorkers);
+static void scanDirectory(struct Listing *listing, struct Worker *worker,
+                          int isPooled);
+static void scanOpenedDirectory(struct Listing *listing, struct Worker *worker,
+                                struct DirectoryScanner *scanner, int isPooled);
+static void readDirectoryEntries(struct Listing *listing,
+                                 struct Worker *worker,
+                                 struct DirectoryScanner *scanner,
+                                 int isPooled);
+static void createCacheDirectory(void);
+static int saveCacheKey(int directoryDescriptor, struct CacheKey *key);
+static int formatCachePath(char *path, const struct CacheKey *key);
+static uint64_t hashCacheData(const char *data, size_t size);
+static int isCacheValid(const struct CacheHeader *header,
+                        const struct CacheKey *key, size_t fileSize);
+static int loadListingCache(struct Listing *listing, struct Worker *worker,
+                            const struct CacheKey *key);
+static uint32_t appendCacheString(char *data, uint32_t *dataSize,
+                                  const char *string, size_t length);
+static void saveListingCache(const struct Listing *listing,
+                             const struct CacheKey *key);
+static uint64_t loadNameChunk(const char *name);
+static int compareNameKeys(const struct SortKey *keyI,
+                           const struct SortKey *keyII, size_t depth,
+                           const char *names);
+static void sortKeysByRadix(struct SortKey *keys, struct SortKey *buffer,
+                            size_t totalKeys);
+static void sortNameKeys(struct SortKey *keys, struct SortKey *buffer,
+                         size_t totalKeys, size_t depth, const char *names);
+static void sortNumericKeys(struct SortKey *keys, struct SortKey *buffer,
+                            size_t totalKeys, const char *names);
+static int compareVersions(const char *nameI, const char *nameII);
+static void sortVersionKeys(struct SortKey *keys, struct SortKey *buffer,
+                            size_t totalKeys, const char *names);
+static void sortEntries(struct Entry *entries, size_t totalEntries,
+                        const char *names);
+static long findUTCOffset(struct DateCache *cache, time_t time);
+static struct DateCacheSlot *findModifiedDate(struct DateCache *cache,
+                                              time_t time, int *dayMinutes);
+static void formatListingHeader(struct Listing *listing,
+                                struct Worker *worker);
+static void formatEntry(struct Listing *listing, const struct Entry *entry,
+                        size_t number, struct Worker *worker);
+static void formatEmptyListing(struct Listing *listing);
+static const char *findRecordEscape(unsigned char character, char *buffer);
+static size_t measureUTF8Character(const char *string);
+static int isUTF8String(const char *string);
+static void appendRecordString(struct OutputBuffer *output, const char *string);
+static void appendRecordBase64(struct OutputBuffer *output, const char *string);
+static void appendRecordField(struct OutputBuffer *output, const char *key,
+                              int isFirst);
+static void appendRecordNull(struct OutputBuffer *output);
+static void appendRecordText(struct OutputBuffer *output, const char *key,
+                             const char *string, int isFirst);
+static void formatRecord(struct Listing *listing, const struct Entry *entry);
+static void formatListing(struct Listing *listing, struct Worker *worker);
+static void writeListing(struct Listing *listing);
+static void createAllocators(void);
 static void readDirectory(const char *directoryPath);
+static void streamDirectory(const char *directoryPath);
+#if defined(__linux__)
+static void compactWatchedNames(struct Watch *watch);
+static uint32_t saveWatchedNames(struct Watch *watch, const char *names,
+                                 size_t size);
+static struct Entry *findWatchedSlot(struct Watch *watch, const char *name);
+static void indexWatchedEntries(struct Watch *watch);
+static void removeWatchedSlot(struct Watch *watch, struct Entry *slot);
+static void measureWatchedColumns(struct Entry *entry, int *lengths);
+static void loadWatchedColumns(struct Watch *watch);
+static void saveWatchedColumns(struct Watch *watch, struct Entry *entry,
+                               int isRemoved);
+static void markWatchedRow(struct Watch *watch, size_t index);
+static int loadWatchedEntries(struct Watch *watch);
+static size_t findWatchedEntry(struct Watch *watch, const struct Entry *entry);
+static void removeWatchedEntry(struct Watch *watch, const char *name);
+static void saveWatchedEntry(struct Watch *watch, const char *name);
+static int applyWatchEvents(struct Watch *watch);
+static void formatWatchFrame(struct Watch *watch);
+static void appendWatchRows(struct Watch *watch, size_t row, size_t totalRows);
+static void writeWatchFrame(struct Watch *watch);
+static void handleWatchSignal(int signal);
 #endif
+static void watchDirectory(const char *directoryPath);
+static void *runListingWorker(void *queue);
+static void readDirectories(struct tmk_CmdArguments *cmdArguments,
+                            int *directoryOffsets, int totalDirectories);
+static void enqueueTreeNode(int queue, struct TreeNode *node);
+static void unlinkTreeNode(struct TreeNode *node);
+static struct TreeNode *takeTreeNode(int queue);
+static int isTreeNodeRepeated(const struct TreeNode *node);
+static void saveTreeNodeChildren(struct TreeNode *node);
+static void listTreeNode(struct Worker *worker, struct TreeNode *node);
+static void finishTreeNode(int queue, struct TreeNode *node);
+static void *runTreeWorker(void *worker);
+static struct TreeNode *findNextTreeNode(struct TreeNode *node);
+static void walkTrees(struct tmk_CmdArguments *cmdArguments,
+                      int *directoryOffsets, int totalDirectories);
+static size_t raiseDescriptorsLimit(void);
+static void createSizeWalk(void);
+static void enqueueSizeTask(int queue, struct SizeTask *task);
+static struct SizeTask *takeSizeTask(int queue);
+static struct SizeTask *createSizeTask(struct SizeTask *parent,
+                                       struct SizeMeasure *measure,
+                                       struct DirectorySize *size,
+                                       const char *name);
+static void releaseSizeTask(struct SizeTask *task);
+static int claimInode(struct SizeMeasure *measure,
+                      const struct DirectorySize *size, dev_t device,
+                      ino_t inode);
+static int openSizeTask(struct Worker *worker, struct SizeTask *task,
+                        struct DirectoryScanner *scanner);
+static void measureSizeTask(struct Worker *worker, int queue,
+                            struct SizeTask *task);
+static void *runSizeWorker(void *worker);
+static int measureDirectories(struct Worker *worker, int directoryDescriptor,
+                              struct Entry *entries, size_t totalEntries,
+                              const char *names);
+static void freeSizeWalk(void);
+static uint64_t readStatsClock(clockid_t clock);
+static void startStatsClock(struct StatsClock *clock);
+static void stopStatsClock(struct Worker *worker, enum StatsPhase phase,
+                           const struct StatsClock *clock, size_t totalCalls);
+static void savePhaseStats(struct PhaseStats *stats,
+                           const struct StatsClock *clock, size_t totalCalls);
+static void saveWorkerStats(const struct Worker *worker);
+static void saveArenaStats(const struct ArenaAllocator *allocator);
+static void writeTextStats(void);
+static void writeJSONStats(void);
+static void writeStats(void);
+static void reserveOutput(struct OutputBuffer *output, size_t size);
+static void appendOutput(struct OutputBuffer *output, const char *buffer,
+                         size_t size);
+static void appendOutputString(struct OutputBuffer *output, const char *string);
+static void appendOutputEscape(struct OutputBuffer *output, const char *escape);
+static void appendOutputCharacters(struct OutputBuffer *output, char character,
+                                   int total);
+static void appendOutputPadded(struct OutputBuffer *output, const char *string,
+                               int width, int isRightAligned);
+static size_t appendOutputNumber(struct OutputBuffer *output,
+                                 unsigned long long number, int base,
+                                 int width, char padding);
+static void flushOutput(struct OutputBuffer *output);
+static size_t writeOutput(const char *buffer, size_t size);
+#endif
+#if tmk_IS_OPERATING_SYSTEM_WINDOWS
 static int sortEntriesAlphabetically(const void *entryI, const void *entryII);
 static void writeLines(size_t totalLines, ...);
-static char *formatModifiedDate(int month, int day, int year,
-                                size_t *bufferSize);
-static char *formatSize(size_t *bufferLength, unsigned long long entrySize,
-                        int isDirectory);
+static char *formatModifiedDate(struct ArenaAllocator *allocator, int month,
+                                int day, int year, size_t *bufferSize);
+#endif
+static int formatSize(char *buffer, unsigned long long entrySize);
 static int countDigits(size_t number);
 static void writeErrorArguments(const char *format, va_list arguments);
 static void writeError(const char *format, ...);
 static void throwError(const char *format, ...);
+static const char *getOptionValue(struct tmk_CmdArguments *cmdArguments,
+                                  const char *option, int *offset);
+#if !tmk_IS_OPERATING_SYSTEM_WINDOWS
+static void parseTotalWorkers(const char *value);
+static void parseCredentialsMode(const char *value);
+static void parseSortKind(const char *value);
+static void parseOutputFormat(const char *value);
+static void parseTotalTopEntries(const char *value);
+static void parseMaximumDepth(const char *value);
+static void parseStatsFormat(const char *value);
+static void parseNamePattern(const char *value, int isExcluding);
+static void parseEntryTypes(const char *value);
+static void parseMinimumSize(const char *value);
+static void parseMinimumAge(const char *value);
+static void parseOwner(const char *value);
+static void resolveMinimumSize(void);
+#endif
 static void writeHelpPage(void);
 static void writeVersionPage(void);
 static void *allocateHeapMemory(size_t totalBytes);
+static struct ArenaBlock *allocateArenaBlock(size_t unit, size_t capacity);
+static void freeArenaBlock(struct ArenaBlock *block);
 static void createArenaAllocator(const char *name, size_t unit, size_t capacity,
                                  struct ArenaAllocator **allocator);
 static void *allocateArenaMemory(struct ArenaAllocator *allocator,
                                  size_t totalAllocations);
+static void *compactArenaAllocator(struct ArenaAllocator *allocator);
 static void resetArenaAllocator(struct ArenaAllocator *allocator);
 static void freeArenaMemory(struct ArenaAllocator *allocator,
                             size_t totalAllocations);
@@ -134,10 +969,82 @@ static struct ArenaAllocator *userCredentialsAllocator_g = NULL;
 static struct ArenaAllocator *userCredentialsDataAllocator_g = NULL;
 static struct ArenaAllocator *groupCredentialsAllocator_g = NULL;
 static struct ArenaAllocator *groupCredentialsDataAllocator_g = NULL;
+static struct CredentialTable userCredentialsTable_g = {NULL};
+static struct CredentialTable groupCredentialsTable_g = {NULL};
+static enum CredentialsMode credentialsMode_g = CredentialsMode_Automatic;
+static enum SortKind sortKind_g = SortKind_Name;
+static int isSortReversed_g = 0;
+static enum OutputFormat outputFormat_g = OutputFormat_Table;
+static const char *recordsHeader_g = NULL;
+static size_t totalTopEntries_g = 0;
+static size_t totalMeasuredTopEntries_g = 0;
+static int isStreaming_g = 0;
+static int maximumDepth_g = 0;
+static int isMeasuringDirectories_g = 0;
+static int isSizeAllocated_g = 0;
+static int isCaching_g = 0;
+static char *cacheDirectoryPath_g = NULL;
+static int isWatching_g = 0;
+static volatile sig_atomic_t watchSignal_g = 0;
+static struct NamePattern *namePatterns_g = NULL;
+static size_t totalNamePatterns_g = 0;
+static size_t totalIncludePatterns_g = 0;
+static int isNameRegex_g = 0;
+static unsigned int entryTypesMask_g = 0;
+static int isSizeFiltered_g = 0;
+static unsigned long long minimumSize_g = 0;
+static int minimumSizeExponent_g = 0;
+static int isAgeFiltered_g = 0;
+static time_t maximumModifiedTime_g = 0;
+static int isOwnerFiltered_g = 0;
+static uid_t ownerId_g = 0;
+static enum StatsFormat statsFormat_g = StatsFormat_None;
+static struct Stats stats_g = {0};
+static const char *const statsPhaseNames_g[] = {
+    "readdir", "stat",   "readlink", "credentials",
+    "sort",    "render", "write"};
+#if defined(STATX_TYPE)
+static int isStatxAvailable_g = 1;
+#endif
+static int isIOURingEnabled_g = 0;
+static struct Worker *workers_g = NULL;
+static struct WorkerPool workerPool_g = {
+    .mutex = PTHREAD_MUTEX_INITIALIZER,
+    .workCondition = PTHREAD_COND_INITIALIZER,
+    .doneCondition = PTHREAD_COND_INITIALIZER};
+static pthread_mutex_t credentialsMutex_g = PTHREAD_MUTEX_INITIALIZER;
+static struct SizeWalk sizeWalk_g = {.mutex = PTHREAD_MUTEX_INITIALIZER,
+                                     .workCondition = PTHREAD_COND_INITIALIZER,
+                                     .doneCondition = PTHREAD_COND_INITIALIZER};
+static struct TreeWalk treeWalk_g = {.mutex = PTHREAD_MUTEX_INITIALIZER,
+                                     .workCondition = PTHREAD_COND_INITIALIZER,
+                                     .doneCondition = PTHREAD_COND_INITIALIZER};
+static int totalWorkers_g = 1;
+static const char *const ansiColorEscapes_g[] = {
+    "\x1b[30m", "\x1b[31m", "\x1b[32m", "\x1b[33m", "\x1b[34m", "\x1b[35m",
+    "\x1b[36m", "\x1b[37m", "\x1b[90m", "\x1b[91m", "\x1b[92m", "\x1b[93m",
+    "\x1b[94m", "\x1b[95m", "\x1b[96m", "\x1b[97m"};
+static int isOutputColored_g = 0;
+/* Indexed by the 9 permission bits of a mode, generated by the preprocessor. */
+static const struct Permissions permissions_g[] = {
+    USER_PERMISSIONS(0), USER_PERMISSIONS(1), USER_PERMISSIONS(2),
+    USER_PERMISSIONS(3), USER_PERMISSIONS(4), USER_PERMISSIONS(5),
+    USER_PERMISSIONS(6), USER_PERMISSIONS(7)};
+/* Indexed by the file type bits of a mode. */
+static const struct EntryType entryTypes_g[] = {
+    [S_IFDIR >> 12] = {ANSI_DARK_YELLOW, " ", "d ", "directory"},
+    [S_IFLNK >> 12] = {ANSI_DARK_BLUE, "󰌷 ", "l ", "symlink"},
+    [S_IFBLK >> 12] = {ANSI_DARK_MAGENTA, "󰇖 ", "b ", "block"},
+    [S_IFCHR >> 12] = {ANSI_DARK_GREEN, "󱣴 ", "c ", "character"},
+    [S_IFIFO >> 12] = {ANSI_DARK_BLUE, "󰟦 ", "f ", "fifo"},
+    [S_IFREG >> 12] = {ANSI_RESET_COLORS, " ", "- ", "file"},
+    [S_IFSOCK >> 12] = {ANSI_DARK_CYAN, "󱄙 ", "s ", "socket"}};
 #endif
 static struct ArenaAllocator *entriesAllocator_g = NULL;
 static struct ArenaAllocator *entriesDataAllocator_g = NULL;
 static struct ArenaAllocator *temporaryDataAllocator_g = NULL;
+static unsigned long long sizeBase_g = 1024;
+static int isSizeExact_g = 0;
 static int exitCode_g = 0;
 
 #if DEBUG
@@ -153,8 +1060,13 @@ static void debugArenaAllocator(struct ArenaAllocator *allocator) {
   tmk_write("%s", allocator->name);
   tmk_resetFontWeight();
   tmk_writeLine(":");
-  tmk_writeLine("    Buffer: %p -> %p.", allocator->buffer,
-                allocator->buffer + allocator->capacity * allocator->unit);
+  for (struct ArenaBlock *block = allocator->block; block;
+       block = block->previous) {
+    tmk_writeLine("     Block: %p -> %p (%zu/%zu%s).", block->buffer,
+                  block->buffer + block->capacity * allocator->unit,
+                  block->use, block->capacity,
+                  block->mappingSize ? ", mapped" : "");
+  }
   tmk_writeLine("       Use: %zu.", allocator->use);
   tmk_writeLine("  Capacity: %zu.", allocator->capacity);
   tmk_writeLine("      Unit: %zu.", allocator->unit);
@@ -198,11 +1110,12 @@ static struct Credential *findCredential(const wchar_t *utf16DirectoryPath,
   BOOL isOwnerDefaulted;
   GetSecurityDescriptorOwner(securityDescriptorBuffer_g, &sid,
                              &isOwnerDefaulted);
-  for (size_t index = 0; index < credentialsAllocator_g->use; ++index) {
-    if (EqualSid(
-            ((struct Credential *)credentialsAllocator_g->buffer + index)->sid,
-            sid)) {
-      return (struct Credential *)credentialsAllocator_g->buffer + index;
+  for (struct ArenaBlock *block = credentialsAllocator_g->block; block;
+       block = block->previous) {
+    for (size_t index = 0; index < block->use; ++index) {
+      if (EqualSid(((struct Credential *)block->buffer + index)->sid, sid)) {
+        return (struct Credential *)block->buffer + index;
+      }
     }
   }
   DWORD utf16UserSize = 0;
@@ -289,22 +1202,24 @@ static void readDirectory(const char *utf8DirectoryPath,
     entry->modifiedTime = entryData.ftLastWriteTime;
     entry->name = convertArenaUTF16ToUTF8(entriesDataAllocator_g,
                                           entryData.cFileName, NULL);
-    size_t sizeLength;
-    entry->size = formatSize(
-        &sizeLength,
+    entry->size =
         ((ULARGE_INTEGER){entryData.nFileSizeLow, entryData.nFileSizeHigh})
-            .QuadPart,
-        entryData.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY);
+            .QuadPart;
+    entry->hasSize = !(entryData.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY);
     if (entry->credential) {
       SAVE_GREATER(userColumnLength, entry->credential->user.length);
       SAVE_GREATER(domainColumnLength, entry->credential->domain.length);
     }
-    SAVE_GREATER(sizeColumnLength, sizeLength);
+    if (entry->hasSize) {
+      char size[SIZE_BUFFER_SIZE];
+      int sizeLength = formatSize(size, entry->size);
+      SAVE_GREATER(sizeColumnLength, sizeLength);
+    }
   } while (FindNextFileW(directoryStream, &entryData));
   FindClose(directoryStream);
   int totalDigitsForIndex = countDigits(entriesAllocator_g->use);
   SAVE_GREATER(indexColumnLength, totalDigitsForIndex);
-  qsort(entriesAllocator_g->buffer, entriesAllocator_g->use,
+  qsort(compactArenaAllocator(entriesAllocator_g), entriesAllocator_g->use,
         sizeof(struct Entry), sortEntriesAlphabetically);
   tmk_setFontAnsiColor(tmk_AnsiColor_DarkYellow, tmk_Layer_Foreground);
   if (!tmk_isStreamRedirected(tmk_Stream_Output)) {
@@ -351,7 +1266,8 @@ static void readDirectory(const char *utf8DirectoryPath,
     tmk_resetFontColors();
   }
   for (size_t index = 0; index < entriesAllocator_g->use; ++index) {
-    struct Entry entry = *((struct Entry *)entriesAllocator_g->buffer + index);
+    struct Entry entry =
+        *((struct Entry *)entriesAllocator_g->block->buffer + index);
     tmk_write("%*zu ", indexColumnLength, index + 1);
     if (entry.credential) {
       tmk_setFontAnsiColor(tmk_AnsiColor_DarkRed, tmk_Layer_Foreground);
@@ -365,16 +1281,18 @@ static void readDirectory(const char *utf8DirectoryPath,
     SYSTEMTIME localModifiedTime;
     FileTimeToSystemTime(&entry.modifiedTime, &localModifiedTime);
     size_t modifiedDateSize;
-    char *modifiedDate =
-        formatModifiedDate(localModifiedTime.wMonth - 1, localModifiedTime.wDay,
-                           localModifiedTime.wYear, &modifiedDateSize);
+    char *modifiedDate = formatModifiedDate(
+        temporaryDataAllocator_g, localModifiedTime.wMonth - 1,
+        localModifiedTime.wDay, localModifiedTime.wYear, &modifiedDateSize);
     tmk_write("%s ", modifiedDate);
     freeArenaMemory(temporaryDataAllocator_g, modifiedDateSize);
     tmk_setFontAnsiColor(tmk_AnsiColor_DarkMagenta, tmk_Layer_Foreground);
     tmk_write("%02d:%02d ", localModifiedTime.wHour, localModifiedTime.wMinute);
-    if (entry.size) {
+    if (entry.hasSize) {
+      char size[SIZE_BUFFER_SIZE];
+      formatSize(size, entry.size);
       tmk_setFontAnsiColor(tmk_AnsiColor_DarkRed, tmk_Layer_Foreground);
-      tmk_write("%*s ", sizeColumnLength, entry.size);
+      tmk_write("%*s ", sizeColumnLength, size);
     } else {
       tmk_resetFontColors();
       tmk_write("%*c ", sizeColumnLength, '-');
@@ -401,241 +1319,3797 @@ static void readDirectory(const char *utf8DirectoryPath,
   resetArenaAllocator(entriesDataAllocator_g);
 }
 #else
-static struct Credential *findCredential(int isUser, unsigned int id) {
-  if (!userCredentialsAllocator_g || !groupCredentialsAllocator_g) {
-    return NULL;
-  }
-  struct ArenaAllocator *credentials =
-      isUser ? userCredentialsAllocator_g : groupCredentialsAllocator_g;
-  struct ArenaAllocator *buffer =
-      isUser ? userCredentialsDataAllocator_g : groupCredentialsDataAllocator_g;
-  for (size_t offset = 0; offset < credentials->use; ++offset) {
-    if (((struct Credential *)credentials->buffer + offset)->id == id) {
-      return (struct Credential *)credentials->buffer + offset;
-    }
+static int openDirectoryScanner(int parentDescriptor, const char *directoryPath,
+                                char *buffer,
+                                struct DirectoryScanner *scanner) {
+  /* Only the directories given are opened through symlinks. */
+  scanner->descriptor =
+      openat(parentDescriptor, directoryPath,
+             O_RDONLY | O_DIRECTORY | O_CLOEXEC |
+                 (parentDescriptor == AT_FDCWD ? 0 : O_NOFOLLOW));
+  if (scanner->descriptor < 0) {
+    return -1;
   }
-  struct Credential *credential = allocateArenaMemory(credentials, 1);
-  const char *name;
-  if (isUser) {
-    struct passwd *user = getpwuid(id);
-    if (!user) {
-      freeArenaMemory(credentials, 1);
-      return NULL;
-    }
-    name = user->pw_name;
-  } else {
-    struct group *group = getgrgid(id);
-    if (!group) {
-      freeArenaMemory(credentials, 1);
-      return NULL;
-    }
-    name = group->gr_name;
+#if !defined(__linux__)
+  scanner->stream = fdopendir(scanner->descriptor);
+  if (!scanner->stream) {
+    close(scanner->descriptor);
+    return -1;
   }
-  credential->id = id;
-  credential->name.length = strlen(name);
-  credential->name.buffer =
-      allocateArenaMemory(buffer, credential->name.length + 1);
-  memcpy(credential->name.buffer, name, credential->name.length + 1);
-  return credential;
+  scanner->pendingEntry = NULL;
+#endif
+  scanner->buffer = buffer;
+  scanner->offset = 0;
+  scanner->length = 0;
+  scanner->isFiltered = 0;
+  return 0;
 }
 
-static void readDirectory(const char *directoryPath) {
-  DIR *directoryStream = opendir(directoryPath);
-  if (!directoryStream) {
-    struct stat directoryStat;
-    writeError(stat(directoryPath, &directoryStat)
-                   ? "can not find the entry \"%s\"."
-               : S_ISDIR(directoryStat.st_mode)
-                   ? "can not open the directory \"%s\"."
-                   : "the entry \"%s\" is not a directory.",
-               directoryPath);
-    return;
-  }
-  createArenaAllocator("entriesAllocator_g", sizeof(struct Entry), 30000,
-                       &entriesAllocator_g);
-  createArenaAllocator("entriesDataAllocator_g", sizeof(char), 2097152,
-                       &entriesDataAllocator_g);
-  createArenaAllocator("temporaryDataAllocator_g", sizeof(char), 500,
-                       &temporaryDataAllocator_g);
-  createArenaAllocator("userCredentialsAllocator_g", sizeof(struct Credential),
-                       20, &userCredentialsAllocator_g);
-  createArenaAllocator("userCredentialsDataAllocator_g", sizeof(char), 320,
-                       &userCredentialsDataAllocator_g);
-  createArenaAllocator("groupCredentialsAllocator_g", sizeof(struct Credential),
-                       20, &groupCredentialsAllocator_g);
-  createArenaAllocator("groupCredentialsDataAllocator_g", sizeof(char), 320,
-                       &groupCredentialsDataAllocator_g);
-  size_t directoryPathLength = strlen(directoryPath);
-  int indexColumnLength = 3;
-  int userColumnLength = 4;
-  int groupColumnLength = 5;
-  int sizeColumnLength = 4;
-  for (struct dirent *entryData; (entryData = readdir(directoryStream));) {
+static size_t scanDirectoryBatch(struct Worker *worker,
+                                 struct DirectoryScanner *scanner,
+                                 size_t capacity) {
+  struct DirectoryRecord *records = worker->records;
+  size_t totalRecords = 0;
+  struct StatsClock clock;
+#if defined(__linux__)
+  /* Records point into the buffer, so a batch ends once it is consumed. */
+  do {
+    if (scanner->offset >= scanner->length) {
+      startStatsClock(&clock);
+      long length = syscall(SYS_getdents64, scanner->descriptor,
+                            scanner->buffer, DIRECTORY_BUFFER_SIZE);
+      stopStatsClock(worker, StatsPhase_Readdir, &clock, 1);
+      if (length <= 0) {
+        return 0;
+      }
+      scanner->offset = 0;
+      scanner->length = length;
+    }
+    while (scanner->offset < scanner->length && totalRecords < capacity) {
+      struct LinuxDirectoryEntry *entryData =
+          (struct LinuxDirectoryEntry *)(scanner->buffer + scanner->offset);
+      scanner->offset += entryData->size;
+      if (entryData->name[0] == '.' &&
+          (!entryData->name[1] ||
+           (entryData->name[1] == '.' && !entryData->name[2]))) {
+        continue;
+      }
+      size_t nameSize = strlen(entryData->name) + 1;
+      if (scanner->isFiltered &&
+          !isScannedEntryIncluded(entryData->name, nameSize - 1,
+                                  entryData->type)) {
+        continue;
+      }
+      struct DirectoryRecord *record = records + totalRecords++;
+      record->name = entryData->name;
+      record->nameSize = nameSize;
+      record->type = entryData->type;
+    }
+  } while (!totalRecords);
+#else
+  /* readdir reuses its entry, so names are copied into the buffer. */
+  scanner->length = 0;
+  size_t totalReads = 0;
+  startStatsClock(&clock);
+  while (totalRecords < capacity) {
+    totalReads += !scanner->pendingEntry;
+    struct dirent *entryData = scanner->pendingEntry
+                                   ? scanner->pendingEntry
+                                   : readdir(scanner->stream);
+    scanner->pendingEntry = NULL;
+    if (!entryData) {
+      break;
+    }
     if (entryData->d_name[0] == '.' &&
         (!entryData->d_name[1] ||
          (entryData->d_name[1] == '.' && !entryData->d_name[2]))) {
       continue;
     }
-    struct Entry *entry = allocateArenaMemory(entriesAllocator_g, 1);
-    size_t entryNameSize = strlen(entryData->d_name) + 1;
-    size_t entryPathSize = directoryPathLength + entryNameSize + 1;
-    char *entryPath =
-        allocateArenaMemory(temporaryDataAllocator_g, entryPathSize);
-    memcpy(entryPath, directoryPath, directoryPathLength);
-    entryPath[directoryPathLength] = '/';
-    memcpy(entryPath + directoryPathLength + 1, entryData->d_name,
-           entryNameSize);
-    struct stat entryStat;
-    lstat(entryPath, &entryStat);
-    if (S_ISLNK(entryStat.st_mode)) {
-      char link[256];
-      link[readlink(entryPath, link, sizeof(link))] = 0;
-      size_t linkSize = strlen(link) + 1;
-      entry->link = allocateArenaMemory(entriesDataAllocator_g, linkSize);
-      memcpy(entry->link, link, linkSize);
+    size_t nameSize = strlen(entryData->d_name) + 1;
+    if (scanner->isFiltered &&
+        !isScannedEntryIncluded(entryData->d_name, nameSize - 1,
+                                entryData->d_type)) {
+      continue;
+    }
+    if (scanner->length + nameSize > DIRECTORY_BUFFER_SIZE) {
+      scanner->pendingEntry = entryData;
+      break;
+    }
+    struct DirectoryRecord *record = records + totalRecords++;
+    record->name = memcpy(scanner->buffer + scanner->length, entryData->d_name,
+                          nameSize);
+    record->nameSize = nameSize;
+    record->type = entryData->d_type;
+    scanner->length += nameSize;
+  }
+  stopStatsClock(worker, StatsPhase_Readdir, &clock, totalReads);
+#endif
+  return totalRecords;
+}
+
+static void closeDirectoryScanner(struct DirectoryScanner *scanner) {
+#if defined(__linux__)
+  close(scanner->descriptor);
+#else
+  closedir(scanner->stream);
+#endif
+}
+
+static void compileNamePatterns(void) {
+  /* Literals starred at their ends, like "*.log", skip fnmatch. */
+  for (size_t index = 0; index < totalNamePatterns_g; ++index) {
+    struct NamePattern pattern = namePatterns_g[index];
+    if (isNameRegex_g) {
+      int error = regcomp(&pattern.regex, pattern.value,
+                          REG_EXTENDED | REG_NOSUB);
+      if (error) {
+        char message[256];
+        regerror(error, &pattern.regex, message, sizeof(message));
+        throwError("the pattern \"%s\" is not a valid regex: %s.",
+                   pattern.value, message);
+      }
+      pattern.kind = NamePatternKind_Regex;
     } else {
-      entry->link = NULL;
+      const char *start = pattern.value + (*pattern.value == '*');
+      size_t length = strlen(start);
+      int hasEndStar = length && start[length - 1] == '*';
+      length -= hasEndStar;
+      pattern.kind = NamePatternKind_Glob;
+      if (strcspn(start, "*?[\\") >= length) {
+        int hasStartStar = start != pattern.value;
+        pattern.kind = hasStartStar && hasEndStar ? NamePatternKind_Infix
+                       : hasStartStar             ? NamePatternKind_Suffix
+                       : hasEndStar               ? NamePatternKind_Prefix
+                                                  : NamePatternKind_Literal;
+        pattern.literal = allocateHeapMemory(length + 1);
+        memcpy(pattern.literal, start, length);
+        pattern.literal[length] = 0;
+        pattern.literalLength = length;
+      }
     }
-    freeArenaMemory(temporaryDataAllocator_g, entryPathSize);
-    size_t sizeLength;
-    entry->size =
-        formatSize(&sizeLength, entryStat.st_size, S_ISDIR(entryStat.st_mode));
-    entry->modifiedTime = entryStat.st_mtime;
-    entry->mode = entryStat.st_mode;
-    entry->user = findCredential(1, entryStat.st_uid);
-    entry->group = findCredential(0, entryStat.st_gid);
-    entry->name = allocateArenaMemory(entriesDataAllocator_g, entryNameSize);
-    memcpy(entry->name, entryData->d_name, entryNameSize);
-    if (entry->user) {
-      SAVE_GREATER(userColumnLength, entry->user->name.length);
-    }
-    if (entry->group) {
-      SAVE_GREATER(groupColumnLength, entry->group->name.length);
+    totalIncludePatterns_g += !pattern.isExcluding;
+    namePatterns_g[index] = pattern;
+  }
+}
+
+static int matchNamePattern(const struct NamePattern *pattern,
+                            const char *name, size_t length) {
+  const char *literal = pattern->literal;
+  size_t literalLength = pattern->literalLength;
+  switch (pattern->kind) {
+  case NamePatternKind_Literal:
+    return length == literalLength && !memcmp(name, literal, length);
+  case NamePatternKind_Prefix:
+    return length >= literalLength && !memcmp(name, literal, literalLength);
+  case NamePatternKind_Suffix:
+    return length >= literalLength &&
+           !memcmp(name + length - literalLength, literal, literalLength);
+  case NamePatternKind_Infix:
+    return length >= literalLength && strstr(name, literal);
+  case NamePatternKind_Glob:
+    return !fnmatch(pattern->value, name, 0);
+  case NamePatternKind_Regex:
+    return !regexec(&pattern->regex, name, 0, NULL, 0);
+  }
+  return 0;
+}
+
+static int isNameIncluded(const char *name, size_t length) {
+  int isIncluded = !totalIncludePatterns_g;
+  for (size_t index = 0; index < totalNamePatterns_g; ++index) {
+    const struct NamePattern *pattern = namePatterns_g + index;
+    if ((pattern->isExcluding || !isIncluded) &&
+        matchNamePattern(pattern, name, length)) {
+      if (pattern->isExcluding) {
+        return 0;
+      }
+      isIncluded = 1;
     }
-    SAVE_GREATER(sizeColumnLength, sizeLength);
   }
-  closedir(directoryStream);
-  int totalDigitsForIndex = countDigits(entriesAllocator_g->use);
-  SAVE_GREATER(indexColumnLength, totalDigitsForIndex);
-  tmk_setFontAnsiColor(tmk_AnsiColor_DarkYellow, tmk_Layer_Foreground);
-  if (!tmk_isStreamRedirected(tmk_Stream_Output)) {
-    tmk_write(" ");
+  return isIncluded;
+}
+
+static int isScannedEntryIncluded(const char *name, size_t length,
+                                  unsigned char type) {
+  /* Types the filesystem does not report are only checked once stated. */
+  if (entryTypesMask_g && type != DT_UNKNOWN &&
+      !(entryTypesMask_g & 1u << type)) {
+    return 0;
   }
-  tmk_resetFontColors();
-  char *directoryFullPath = allocateArenaMemory(temporaryDataAllocator_g, 256);
-  realpath(directoryPath, directoryFullPath);
-  tmk_setFontWeight(tmk_FontWeight_Bold);
-  tmk_writeLine("%s:", directoryFullPath);
-  tmk_resetFontWeight();
-  freeArenaMemory(temporaryDataAllocator_g, 256);
-  qsort(entriesAllocator_g->buffer, entriesAllocator_g->use,
-        sizeof(struct Entry), sortEntriesAlphabetically);
-  tmk_setFontWeight(tmk_FontWeight_Bold);
-  tmk_writeLine("%*s %-*s %-*s %-*s %*s %-*s Name", indexColumnLength, "No.",
-                groupColumnLength, "Group", userColumnLength, "User", 17,
-                "Modified Date", sizeColumnLength, "Size", 13, "Mode");
-  tmk_resetFontWeight();
-  writeLines(7, indexColumnLength, groupColumnLength, userColumnLength, 17,
-             sizeColumnLength, 13, 20);
-  if (!entriesAllocator_g->use) {
-    tmk_setFontAnsiColor(tmk_AnsiColor_LightBlack, tmk_Layer_Foreground);
-    tmk_writeLine("%*s",
-                  29 + indexColumnLength + groupColumnLength +
-                      userColumnLength + sizeColumnLength,
-                  "DIRECTORY IS EMPTY");
-    tmk_resetFontColors();
+  return isNameIncluded(name, length);
+}
+
+static void freeNamePatterns(void) {
+  for (size_t index = 0; index < totalNamePatterns_g; ++index) {
+    if (namePatterns_g[index].kind == NamePatternKind_Regex) {
+      regfree(&namePatterns_g[index].regex);
+    }
+    free(namePatterns_g[index].literal);
   }
-  for (size_t index = 0; index < entriesAllocator_g->use; ++index) {
-    struct Entry entry = *((struct Entry *)entriesAllocator_g->buffer + index);
-    tmk_write("%*zu ", indexColumnLength, index + 1);
-    if (entry.group) {
-      tmk_setFontAnsiColor(tmk_AnsiColor_DarkRed, tmk_Layer_Foreground);
-      tmk_write("%-*s ", groupColumnLength, entry.group->name.buffer);
-    } else {
-      tmk_write("%-*c ", groupColumnLength, '-');
+  free(namePatterns_g);
+}
+
+#if defined(STATX_TYPE)
+static void saveStatxData(const struct statx *entryStat,
+                          struct DirectoryRecord *record) {
+  record->size = entryStat->stx_size;
+  record->allocatedSize = entryStat->stx_blocks * 512;
+  record->modifiedTime = entryStat->stx_mtime.tv_sec;
+  record->device =
+      makedev(entryStat->stx_dev_major, entryStat->stx_dev_minor);
+  record->inode = entryStat->stx_ino;
+  record->totalLinks = entryStat->stx_nlink;
+  record->mode = entryStat->stx_mode;
+  record->userId = entryStat->stx_uid;
+  record->groupId = entryStat->stx_gid;
+}
+#endif
+
+static int statDirectoryRecord(int directoryDescriptor,
+                               struct DirectoryRecord *record) {
+#if defined(STATX_TYPE)
+  if (isStatxAvailable_g) {
+    struct statx entryStat;
+    if (!statx(directoryDescriptor, record->name,
+               AT_SYMLINK_NOFOLLOW | AT_NO_AUTOMOUNT, ENTRY_STATX_MASK,
+               &entryStat)) {
+      saveStatxData(&entryStat, record);
+      return 0;
     }
-    if (entry.user) {
-      tmk_setFontAnsiColor(tmk_AnsiColor_DarkGreen, tmk_Layer_Foreground);
-      tmk_write("%-*s ", userColumnLength, entry.user->name.buffer);
-    } else {
-      tmk_resetFontColors();
-      tmk_write("%-*c ", userColumnLength, '-');
+    if (errno != ENOSYS) {
+      return -1;
     }
-    struct tm *localModifiedTime = localtime(&entry.modifiedTime);
-    size_t modifiedDateSize;
-    char *modifiedDate = formatModifiedDate(
-        localModifiedTime->tm_mon, localModifiedTime->tm_mday,
-        localModifiedTime->tm_year + 1900, &modifiedDateSize);
-    tmk_setFontAnsiColor(tmk_AnsiColor_DarkYellow, tmk_Layer_Foreground);
-    tmk_write("%s ", modifiedDate);
-    freeArenaMemory(temporaryDataAllocator_g, modifiedDateSize);
-    tmk_setFontAnsiColor(tmk_AnsiColor_DarkMagenta, tmk_Layer_Foreground);
-    tmk_write("%02d:%02d ", localModifiedTime->tm_hour,
-              localModifiedTime->tm_min);
-    if (entry.size) {
-      tmk_setFontAnsiColor(tmk_AnsiColor_DarkRed, tmk_Layer_Foreground);
-      tmk_write("%*s ", sizeColumnLength, entry.size);
+    isStatxAvailable_g = 0;
+  }
+#endif
+  struct stat entryStat;
+  if (fstatat(directoryDescriptor, record->name, &entryStat,
+              AT_SYMLINK_NOFOLLOW)) {
+    return -1;
+  }
+  record->size = entryStat.st_size;
+  record->allocatedSize = (unsigned long long)entryStat.st_blocks * 512;
+  record->modifiedTime = entryStat.st_mtime;
+  record->device = entryStat.st_dev;
+  record->inode = entryStat.st_ino;
+  record->totalLinks = entryStat.st_nlink;
+  record->mode = entryStat.st_mode;
+  record->userId = entryStat.st_uid;
+  record->groupId = entryStat.st_gid;
+  return 0;
+}
+
+#if defined(HAS_IO_URING)
+static struct IOURing *createIOURing(void) {
+  struct io_uring_params parameters;
+  memset(&parameters, 0, sizeof(parameters));
+  int descriptor = syscall(SYS_io_uring_setup, IO_URING_CAPACITY, &parameters);
+  if (descriptor < 0) {
+    return NULL;
+  }
+  struct IOURing *ring = allocateHeapMemory(sizeof(struct IOURing));
+  ring->descriptor = descriptor;
+  ring->stats = NULL;
+  ring->submissionRingSize =
+      parameters.sq_off.array + parameters.sq_entries * sizeof(unsigned int);
+  ring->completionRingSize =
+      parameters.cq_off.cqes +
+      parameters.cq_entries * sizeof(struct io_uring_cqe);
+  if (parameters.features & IORING_FEAT_SINGLE_MMAP) {
+    SAVE_GREATER(ring->submissionRingSize, ring->completionRingSize);
+    ring->completionRingSize = 0;
+  }
+  ring->submissionRing =
+      mmap(NULL, ring->submissionRingSize, PROT_READ | PROT_WRITE,
+           MAP_SHARED | MAP_POPULATE, descriptor, IORING_OFF_SQ_RING);
+  ring->completionRing =
+      ring->completionRingSize
+          ? mmap(NULL, ring->completionRingSize, PROT_READ | PROT_WRITE,
+                 MAP_SHARED | MAP_POPULATE, descriptor, IORING_OFF_CQ_RING)
+          : ring->submissionRing;
+  ring->submissionsSize = parameters.sq_entries * sizeof(struct io_uring_sqe);
+  ring->submissions =
+      mmap(NULL, ring->submissionsSize, PROT_READ | PROT_WRITE,
+           MAP_SHARED | MAP_POPULATE, descriptor, IORING_OFF_SQES);
+  if (ring->submissionRing == MAP_FAILED ||
+      ring->completionRing == MAP_FAILED || ring->submissions == MAP_FAILED) {
+    freeIOURing(ring);
+    return NULL;
+  }
+  char *submissionRing = ring->submissionRing;
+  char *completionRing = ring->completionRing;
+  ring->submissionHead = (unsigned int *)(submissionRing + parameters.sq_off.head);
+  ring->submissionTail = (unsigned int *)(submissionRing + parameters.sq_off.tail);
+  ring->submissionMask =
+      (unsigned int *)(submissionRing + parameters.sq_off.ring_mask);
+  ring->submissionArray =
+      (unsigned int *)(submissionRing + parameters.sq_off.array);
+  ring->completionHead = (unsigned int *)(completionRing + parameters.cq_off.head);
+  ring->completionTail = (unsigned int *)(completionRing + parameters.cq_off.tail);
+  ring->completionMask =
+      (unsigned int *)(completionRing + parameters.cq_off.ring_mask);
+  ring->completions =
+      (struct io_uring_cqe *)(completionRing + parameters.cq_off.cqes);
+  ring->stats =
+      allocateHeapMemory(DIRECTORY_BATCH_CAPACITY * sizeof(struct statx));
+  return ring;
+}
+
+static void freeIOURing(struct IOURing *ring) {
+  if (!ring) {
+    return;
+  }
+  if (ring->submissions != MAP_FAILED) {
+    munmap(ring->submissions, ring->submissionsSize);
+  }
+  if (ring->completionRingSize && ring->completionRing != MAP_FAILED) {
+    munmap(ring->completionRing, ring->completionRingSize);
+  }
+  if (ring->submissionRing != MAP_FAILED) {
+    munmap(ring->submissionRing, ring->submissionRingSize);
+  }
+  close(ring->descriptor);
+  free(ring->stats);
+  free(ring);
+}
+
+static size_t drainIOURing(struct IOURing *ring, size_t totalInFlight) {
+  /* Requests taken by the kernel still write to their records. */
+  unsigned int submissionHead =
+      __atomic_load_n(ring->submissionHead, __ATOMIC_ACQUIRE);
+  size_t totalTaken = totalInFlight - (*ring->submissionTail - submissionHead);
+  __atomic_store_n(ring->submissionTail, submissionHead, __ATOMIC_RELEASE);
+  size_t totalCalls = 0;
+  while (totalTaken) {
+    unsigned int completionTail =
+        __atomic_load_n(ring->completionTail, __ATOMIC_ACQUIRE);
+    totalTaken -= completionTail - *ring->completionHead;
+    __atomic_store_n(ring->completionHead, completionTail, __ATOMIC_RELEASE);
+    if (!totalTaken) {
+      break;
+    }
+    ++totalCalls;
+    if (syscall(SYS_io_uring_enter, ring->descriptor, 0, 1,
+                IORING_ENTER_GETEVENTS, NULL, 0) < 0 &&
+        errno != EINTR) {
+      sched_yield();
+    }
+  }
+  return totalCalls;
+}
+
+static int statDirectoryRecordsAsynchronously(struct Worker *worker,
+                                              int directoryDescriptor,
+                                              struct DirectoryRecord *records,
+                                              size_t totalRecords,
+                                              size_t *totalCalls) {
+  /* Completions arrive out of order, matched by their user data. */
+  struct IOURing *ring = worker->ioURing;
+  size_t totalSubmitted = 0;
+  size_t totalCompleted = 0;
+  size_t totalInFlight = 0;
+  while (totalCompleted < totalRecords) {
+    unsigned int tail = *ring->submissionTail;
+    unsigned int totalToSubmit = 0;
+    for (; totalSubmitted < totalRecords && totalInFlight < IO_URING_CAPACITY;
+         ++totalSubmitted, ++totalInFlight, ++totalToSubmit) {
+      unsigned int slot = (tail + totalToSubmit) & *ring->submissionMask;
+      struct io_uring_sqe *submission = ring->submissions + slot;
+      memset(submission, 0, sizeof(struct io_uring_sqe));
+      submission->opcode = IORING_OP_STATX;
+      submission->fd = directoryDescriptor;
+      submission->addr = (uintptr_t)records[totalSubmitted].name;
+      submission->len = ENTRY_STATX_MASK;
+      submission->off = (uintptr_t)(ring->stats + totalSubmitted);
+      submission->statx_flags = AT_SYMLINK_NOFOLLOW | AT_NO_AUTOMOUNT;
+      submission->user_data = totalSubmitted;
+      ring->submissionArray[slot] = slot;
+    }
+    __atomic_store_n(ring->submissionTail, tail + totalToSubmit,
+                     __ATOMIC_RELEASE);
+    unsigned int totalPending =
+        tail + totalToSubmit -
+        __atomic_load_n(ring->submissionHead, __ATOMIC_ACQUIRE);
+    ++*totalCalls;
+    if (syscall(SYS_io_uring_enter, ring->descriptor, totalPending, 1,
+                IORING_ENTER_GETEVENTS, NULL, 0) < 0 &&
+        errno != EINTR && errno != EAGAIN) {
+      worker->isIOURingUnavailable = 1;
+      *totalCalls += drainIOURing(ring, totalInFlight);
+      return -1;
+    }
+    unsigned int head = *ring->completionHead;
+    unsigned int completionTail =
+        __atomic_load_n(ring->completionTail, __ATOMIC_ACQUIRE);
+    for (; head != completionTail; ++head, ++totalCompleted, --totalInFlight) {
+      struct io_uring_cqe *completion =
+          ring->completions + (head & *ring->completionMask);
+      struct DirectoryRecord *record = records + completion->user_data;
+      if (!completion->res) {
+        saveStatxData(ring->stats + completion->user_data, record);
+        record->isStated = 1;
+      } else if (completion->res == -EINVAL) {
+        /* Kernels older than 5.6 can not run statx through io_uring. */
+        worker->isIOURingUnavailable = 1;
+        record->isStated = !statDirectoryRecord(directoryDescriptor, record);
+        ++*totalCalls;
+      } else {
+        record->isStated = 0;
+      }
+      if (!record->isStated) {
+        saveUnstatedDirectoryRecord(record);
+      }
+    }
+    __atomic_store_n(ring->completionHead, head, __ATOMIC_RELEASE);
+  }
+  return 0;
+}
+#endif
+
+static void saveUnstatedDirectoryRecord(struct DirectoryRecord *record) {
+  /* Removed since read, it keeps the type its directory reported. */
+  record->size = 0;
+  record->allocatedSize = 0;
+  record->modifiedTime = 0;
+  record->totalLinks = 0;
+  record->mode = record->type == DT_UNKNOWN ? 0 : DTTOIF(record->type);
+}
+
+static void statDirectoryRecordsSynchronously(int directoryDescriptor,
+                                               struct DirectoryRecord *records,
+                                               size_t totalRecords) {
+  for (size_t index = 0; index < totalRecords; ++index) {
+    struct DirectoryRecord *record = records + index;
+    record->isStated = !statDirectoryRecord(directoryDescriptor, record);
+    if (!record->isStated) {
+      saveUnstatedDirectoryRecord(record);
+    }
+  }
+}
+
+static void statDirectoryRecords(struct Worker *worker,
+                                 int directoryDescriptor,
+                                 struct DirectoryRecord *records,
+                                 size_t totalRecords) {
+  struct StatsClock clock;
+  startStatsClock(&clock);
+  size_t totalCalls = 0;
+#if defined(HAS_IO_URING)
+  if (isIOURingEnabled_g && !worker->ioURing &&
+      !worker->isIOURingUnavailable &&
+      !(worker->ioURing = createIOURing())) {
+    worker->isIOURingUnavailable = 1;
+  }
+  if (isIOURingEnabled_g && !worker->isIOURingUnavailable &&
+      !statDirectoryRecordsAsynchronously(worker, directoryDescriptor, records,
+                                          totalRecords, &totalCalls)) {
+    stopStatsClock(worker, StatsPhase_Stat, &clock, totalCalls);
+    return;
+  }
+#endif
+  statDirectoryRecordsSynchronously(directoryDescriptor, records,
+                                    totalRecords);
+  stopStatsClock(worker, StatsPhase_Stat, &clock, totalCalls + totalRecords);
+}
+
+static int isRecordIncluded(const struct DirectoryRecord *record) {
+  /* Unknown sizes and ages never pass their filters. */
+  if (entryTypesMask_g && !(entryTypesMask_g & 1u << IFTODT(record->mode))) {
+    return 0;
+  }
+  if (!record->isStated) {
+    return !isSizeFiltered_g && !isAgeFiltered_g && !isOwnerFiltered_g;
+  }
+  unsigned long long size =
+      isSizeAllocated_g ? record->allocatedSize : record->size;
+  return (!isSizeFiltered_g ||
+          (!S_ISDIR(record->mode) && size > minimumSize_g)) &&
+         (!isAgeFiltered_g || record->modifiedTime < maximumModifiedTime_g) &&
+         (!isOwnerFiltered_g || record->userId == ownerId_g);
+}
+
+static void saveDirectoryRecords(struct Worker *worker,
+                                 int directoryDescriptor,
+                                 struct DirectoryRecord *records,
+                                 size_t totalRecords) {
+  int isFiltered = entryTypesMask_g || isSizeFiltered_g || isAgeFiltered_g ||
+                   isOwnerFiltered_g;
+  for (size_t index = 0; index < totalRecords; ++index) {
+    struct DirectoryRecord *record = records + index;
+    if (isFiltered && !isRecordIncluded(record)) {
+      continue;
+    }
+    if (totalTopEntries_g) {
+      saveTopDirectoryRecord(worker, directoryDescriptor, record);
+      continue;
+    }
+    struct Entry *entry = allocateArenaMemory(worker->entriesAllocator, 1);
+    char link[PATH_MAX];
+    if (S_ISLNK(record->mode)) {
+      struct StatsClock clock;
+      startStatsClock(&clock);
+      ssize_t linkLength =
+          readlinkat(directoryDescriptor, record->name, link, sizeof(link) - 1);
+      stopStatsClock(worker, StatsPhase_Readlink, &clock, 1);
+      link[linkLength < 0 ? 0 : linkLength] = 0;
+    }
+    entry->size = isSizeAllocated_g ? record->allocatedSize : record->size;
+    entry->hasSize = record->isStated && !S_ISDIR(record->mode);
+    entry->modifiedTime = record->modifiedTime;
+    entry->mode = record->mode;
+    entry->userIndex =
+        record->isStated
+            ? findWorkerCredential(worker, 1, record->userId)
+            : UNKNOWN_CREDENTIAL;
+    entry->groupIndex =
+        record->isStated
+            ? findWorkerCredential(worker, 0, record->groupId)
+            : UNKNOWN_CREDENTIAL;
+    entry->nameOffset =
+        saveEntryNames(worker->entriesDataAllocator, record->name,
+                       record->nameSize, S_ISLNK(record->mode) ? link : NULL);
+    saveColumnLengths(worker, entry);
+  }
+}
+
+static uint32_t saveEntryNames(struct ArenaAllocator *allocator,
+                               const char *name, size_t nameSize,
+                               const char *link) {
+  /* Returns the offset the name has once the allocator is compacted. */
+  size_t linkSize = link ? strlen(link) + 1 : 0;
+  size_t offset = allocator->use;
+  if (offset + nameSize + linkSize > UINT32_MAX) {
+    throwError("can not keep more than %zuB of names in a listing.",
+               (size_t)UINT32_MAX);
+  }
+  char *names = allocateArenaMemory(allocator, nameSize + linkSize);
+  memcpy(names, name, nameSize);
+  if (link) {
+    memcpy(names + nameSize, link, linkSize);
+  }
+  return offset;
+}
+
+static const char *findEntryLink(const char *names, const struct Entry *entry) {
+  if (!S_ISLNK(entry->mode)) {
+    return NULL;
+  }
+  const char *name = names + entry->nameOffset;
+  return name + strlen(name) + 1;
+}
+
+static size_t measureEntryNames(const char *names, const struct Entry *entry) {
+  const char *name = names + entry->nameOffset;
+  const char *link = findEntryLink(names, entry);
+  return link ? (size_t)(link - name) + strlen(link) + 1 : strlen(name) + 1;
+}
+
+static void saveColumnLengths(struct Worker *worker, struct Entry *entry) {
+  if (outputFormat_g != OutputFormat_Table) {
+    return;
+  }
+  struct Credential *user = findIndexedCredential(1, entry->userIndex);
+  struct Credential *group = findIndexedCredential(0, entry->groupIndex);
+  if (user && user->name.buffer) {
+    SAVE_GREATER(worker->userColumnLength, user->name.length);
+  }
+  if (group && group->name.buffer) {
+    SAVE_GREATER(worker->groupColumnLength, group->name.length);
+  }
+  if (entry->hasSize) {
+    char size[SIZE_BUFFER_SIZE];
+    int sizeLength = formatSize(size, entry->size);
+    SAVE_GREATER(worker->sizeColumnLength, sizeLength);
+  }
+}
+
+static int compareEntries(const struct Entry *entryI, const char *nameI,
+                          const struct Entry *entryII, const char *nameII) {
+  /* Orders entries as sortEntries does. */
+  int difference = 0;
+  if (sortKind_g == SortKind_Size) {
+    unsigned long long sizeI = entryI->hasSize ? entryI->size : 0;
+    unsigned long long sizeII = entryII->hasSize ? entryII->size : 0;
+    difference = sizeI > sizeII ? -1 : sizeI < sizeII;
+  } else if (sortKind_g == SortKind_ModifiedTime) {
+    difference = entryI->modifiedTime > entryII->modifiedTime ? -1
+                 : entryI->modifiedTime < entryII->modifiedTime;
+  }
+  if (!difference) {
+    difference = sortKind_g == SortKind_Version ? compareVersions(nameI, nameII)
+                                                : strcmp(nameI, nameII);
+  }
+  return isSortReversed_g ? -difference : difference;
+}
+
+static char *copyToBuffer(char **buffer, size_t *capacity, const char *string,
+                          size_t size) {
+  if (size > *capacity) {
+    free(*buffer);
+    *buffer = allocateHeapMemory(size);
+    *capacity = size;
+  }
+  memcpy(*buffer, string, size);
+  return *buffer;
+}
+
+static struct TopEntry *claimTopEntry(struct Worker *worker,
+                                      const struct Entry *candidate,
+                                      const char *name) {
+  /* The root of the heap sorts last. Returns the place taken, or NULL. */
+  if (worker->totalTopEntries == worker->topEntriesCapacity &&
+      worker->topEntriesCapacity < totalTopEntries_g) {
+    size_t capacity = worker->topEntriesCapacity
+                          ? worker->topEntriesCapacity * 2
+                          : TOP_ENTRIES_INITIAL_CAPACITY;
+    if (capacity > totalTopEntries_g) {
+      capacity = totalTopEntries_g;
+    }
+    struct TopEntry *topEntries =
+        allocateHeapMemory(capacity * sizeof(struct TopEntry));
+    if (worker->topEntries) {
+      memcpy(topEntries, worker->topEntries,
+             worker->topEntriesCapacity * sizeof(struct TopEntry));
+    }
+    memset(topEntries + worker->topEntriesCapacity, 0,
+           (capacity - worker->topEntriesCapacity) * sizeof(struct TopEntry));
+    free(worker->topEntries);
+    worker->topEntries = topEntries;
+    worker->topEntriesCapacity = capacity;
+  }
+  struct TopEntry *topEntries = worker->topEntries;
+  size_t offset;
+  if (worker->totalTopEntries < totalTopEntries_g) {
+    offset = worker->totalTopEntries++;
+  } else if (compareEntries(candidate, name, &topEntries->entry,
+                            topEntries->name) < 0) {
+    offset = 0;
+  } else {
+    return NULL;
+  }
+  struct TopEntry topEntry = topEntries[offset];
+  topEntry.entry = *candidate;
+  copyToBuffer(&topEntry.name, &topEntry.nameCapacity, name, strlen(name) + 1);
+  while (offset) {
+    size_t parent = (offset - 1) / 2;
+    if (compareEntries(&topEntries[parent].entry, topEntries[parent].name,
+                       &topEntry.entry, topEntry.name) >= 0) {
+      break;
+    }
+    topEntries[offset] = topEntries[parent];
+    offset = parent;
+  }
+  for (size_t child; (child = offset * 2 + 1) < worker->totalTopEntries;
+       offset = child) {
+    if (child + 1 < worker->totalTopEntries &&
+        compareEntries(&topEntries[child].entry, topEntries[child].name,
+                       &topEntries[child + 1].entry,
+                       topEntries[child + 1].name) < 0) {
+      ++child;
+    }
+    if (compareEntries(&topEntries[child].entry, topEntries[child].name,
+                       &topEntry.entry, topEntry.name) <= 0) {
+      break;
+    }
+    topEntries[offset] = topEntries[child];
+  }
+  topEntries[offset] = topEntry;
+  return topEntries + offset;
+}
+
+static void saveTopDirectoryRecord(struct Worker *worker,
+                                   int directoryDescriptor,
+                                   struct DirectoryRecord *record) {
+  struct Entry candidate = {.size = isSizeAllocated_g ? record->allocatedSize
+                                                      : record->size,
+                            .modifiedTime = record->modifiedTime,
+                            .mode = record->mode,
+                            .hasSize = record->isStated &&
+                                       !S_ISDIR(record->mode)};
+  struct TopEntry *topEntry = claimTopEntry(worker, &candidate, record->name);
+  if (!topEntry) {
+    return;
+  }
+  if (S_ISLNK(record->mode)) {
+    char link[PATH_MAX];
+    struct StatsClock clock;
+    startStatsClock(&clock);
+    ssize_t linkLength =
+        readlinkat(directoryDescriptor, record->name, link, sizeof(link) - 1);
+    stopStatsClock(worker, StatsPhase_Readlink, &clock, 1);
+    link[linkLength < 0 ? 0 : linkLength] = 0;
+    copyToBuffer(&topEntry->link, &topEntry->linkCapacity, link,
+                 strlen(link) + 1);
+  }
+  topEntry->entry.userIndex =
+      record->isStated ? findWorkerCredential(worker, 1, record->userId)
+                       : UNKNOWN_CREDENTIAL;
+  topEntry->entry.groupIndex =
+      record->isStated ? findWorkerCredential(worker, 0, record->groupId)
+                       : UNKNOWN_CREDENTIAL;
+}
+
+static void createWorkers(void) {
+  if (workers_g) {
+    return;
+  }
+  workers_g = allocateHeapMemory(totalWorkers_g * sizeof(struct Worker));
+  memset(workers_g, 0, totalWorkers_g * sizeof(struct Worker));
+  /* The main thread is the first worker, using the global allocators. */
+  workers_g->entriesAllocator = entriesAllocator_g;
+  workers_g->entriesDataAllocator = entriesDataAllocator_g;
+  for (int index = 1; index < totalWorkers_g; ++index) {
+    struct Worker *worker = workers_g + index;
+    createArenaAllocator("workerEntriesAllocator", sizeof(struct Entry), 4096,
+                         &worker->entriesAllocator);
+    createArenaAllocator("workerEntriesDataAllocator", sizeof(char), 262144,
+                         &worker->entriesDataAllocator);
+    if (pthread_create(&worker->thread, NULL, runWorker, worker)) {
+      throwError("can not create a worker thread.");
+    }
+  }
+}
+
+static void *runWorker(void *worker) {
+  unsigned long generation = 0;
+  pthread_mutex_lock(&workerPool_g.mutex);
+  for (;;) {
+    while (workerPool_g.generation == generation && !workerPool_g.isExiting) {
+      pthread_cond_wait(&workerPool_g.workCondition, &workerPool_g.mutex);
+    }
+    if (workerPool_g.isExiting) {
+      break;
+    }
+    generation = workerPool_g.generation;
+    pthread_mutex_unlock(&workerPool_g.mutex);
+    runWorkerPoolChunks(worker);
+    pthread_mutex_lock(&workerPool_g.mutex);
+    if (!--workerPool_g.totalBusyWorkers) {
+      pthread_cond_signal(&workerPool_g.doneCondition);
+    }
+  }
+  pthread_mutex_unlock(&workerPool_g.mutex);
+  return NULL;
+}
+
+static void runWorkerPoolChunks(struct Worker *worker) {
+  for (;;) {
+    size_t begin = __atomic_fetch_add(&workerPool_g.nextRecord,
+                                      WORKER_CHUNK_SIZE, __ATOMIC_RELAXED);
+    if (begin >= workerPool_g.totalRecords) {
+      return;
+    }
+    size_t totalRecords = workerPool_g.totalRecords - begin;
+    if (totalRecords > WORKER_CHUNK_SIZE) {
+      totalRecords = WORKER_CHUNK_SIZE;
+    }
+    if (!workerPool_g.areRecordsStated) {
+      struct StatsClock clock;
+      startStatsClock(&clock);
+      statDirectoryRecordsSynchronously(workerPool_g.directoryDescriptor,
+                                        workerPool_g.records + begin,
+                                        totalRecords);
+      stopStatsClock(worker, StatsPhase_Stat, &clock, totalRecords);
+    }
+    saveDirectoryRecords(worker, workerPool_g.directoryDescriptor,
+                         workerPool_g.records + begin, totalRecords);
+  }
+}
+
+static void runWorkerPool(int directoryDescriptor,
+                          struct DirectoryRecord *records,
+                          size_t totalRecords) {
+  int areRecordsStated = isIOURingEnabled_g;
+  if (areRecordsStated) {
+    statDirectoryRecords(workers_g, directoryDescriptor, records, totalRecords);
+  }
+  if (totalWorkers_g == 1 || totalRecords <= WORKER_CHUNK_SIZE) {
+    if (!areRecordsStated) {
+      statDirectoryRecords(workers_g, directoryDescriptor, records,
+                           totalRecords);
+    }
+    saveDirectoryRecords(workers_g, directoryDescriptor, records,
+                         totalRecords);
+    return;
+  }
+  pthread_mutex_lock(&workerPool_g.mutex);
+  workerPool_g.records = records;
+  workerPool_g.totalRecords = totalRecords;
+  workerPool_g.nextRecord = 0;
+  workerPool_g.directoryDescriptor = directoryDescriptor;
+  workerPool_g.areRecordsStated = areRecordsStated;
+  workerPool_g.totalBusyWorkers = totalWorkers_g - 1;
+  ++workerPool_g.generation;
+  pthread_cond_broadcast(&workerPool_g.workCondition);
+  pthread_mutex_unlock(&workerPool_g.mutex);
+  runWorkerPoolChunks(workers_g);
+  pthread_mutex_lock(&workerPool_g.mutex);
+  while (workerPool_g.totalBusyWorkers) {
+    pthread_cond_wait(&workerPool_g.doneCondition, &workerPool_g.mutex);
+  }
+  pthread_mutex_unlock(&workerPool_g.mutex);
+}
+
+static void createWorkerBuffers(struct Worker *worker) {
+  if (worker->directoryBuffer) {
+    return;
+  }
+  worker->directoryBuffer = allocateHeapMemory(DIRECTORY_BUFFER_SIZE);
+  worker->records = allocateHeapMemory(DIRECTORY_BATCH_CAPACITY *
+                                       sizeof(struct DirectoryRecord));
+}
+
+static void freeWorkerBuffers(struct Worker *worker) {
+  saveWorkerStats(worker);
+  free(worker->records);
+  free(worker->directoryBuffer);
+  for (size_t index = 0; index < worker->topEntriesCapacity; ++index) {
+    free(worker->topEntries[index].name);
+    free(worker->topEntries[index].link);
+  }
+  free(worker->topEntries);
+#if defined(HAS_IO_URING)
+  freeIOURing(worker->ioURing);
+#endif
+}
+
+static void freeWorkers(void) {
+  if (!workers_g) {
+    return;
+  }
+  pthread_mutex_lock(&workerPool_g.mutex);
+  workerPool_g.isExiting = 1;
+  pthread_cond_broadcast(&workerPool_g.workCondition);
+  pthread_mutex_unlock(&workerPool_g.mutex);
+  freeWorkerBuffers(workers_g);
+  for (int index = 1; index < totalWorkers_g; ++index) {
+    pthread_join(workers_g[index].thread, NULL);
+    freeArenaAllocator(workers_g[index].entriesAllocator);
+    freeArenaAllocator(workers_g[index].entriesDataAllocator);
+    freeWorkerBuffers(workers_g + index);
+  }
+  free(workers_g);
+}
+
+static uint32_t findWorkerCredential(struct Worker *worker, int isUser,
+                                     unsigned int id) {
+  /* The last owner is remembered, so the lock is only taken on a change. */
+  if (isUser && worker->hasLastUser && worker->lastUserId == id) {
+    ++worker->stats.totalCredentialHits;
+    return worker->lastUser;
+  }
+  if (!isUser && worker->hasLastGroup && worker->lastGroupId == id) {
+    ++worker->stats.totalCredentialHits;
+    return worker->lastGroup;
+  }
+  struct StatsClock clock;
+  startStatsClock(&clock);
+  pthread_mutex_lock(&credentialsMutex_g);
+  size_t totalLookups = stats_g.totalSystemCredentialLookups;
+  struct Credential *credential = findCredential(isUser, id);
+  totalLookups = stats_g.totalSystemCredentialLookups - totalLookups;
+  pthread_mutex_unlock(&credentialsMutex_g);
+  stopStatsClock(worker, StatsPhase_Credentials, &clock, totalLookups);
+  ++worker->stats.totalCredentialLookups;
+  uint32_t index = credential ? credential->index : UNKNOWN_CREDENTIAL;
+  if (isUser) {
+    worker->lastUser = index;
+    worker->lastUserId = id;
+    worker->hasLastUser = 1;
+  } else {
+    worker->lastGroup = index;
+    worker->lastGroupId = id;
+    worker->hasLastGroup = 1;
+  }
+  return index;
+}
+
+static struct Credential *findIndexedCredential(int isUser, uint32_t index) {
+  /* Chunks never move, so credentials are read without the lock. */
+  if (index == UNKNOWN_CREDENTIAL) {
+    return NULL;
+  }
+  struct CredentialTable *table =
+      isUser ? &userCredentialsTable_g : &groupCredentialsTable_g;
+  struct CredentialChunks *chunks =
+      __atomic_load_n(&table->chunks, __ATOMIC_ACQUIRE);
+  return chunks->chunks[index / CREDENTIAL_CHUNK_CAPACITY]
+                       [index % CREDENTIAL_CHUNK_CAPACITY];
+}
+
+static struct Credential **findCredentialSlot(struct CredentialTable *table,
+                                              unsigned int id) {
+  /* Multiplicative hash and linear probing, over a power of two capacity. */
+  size_t mask = table->capacity - 1;
+  for (size_t index = (id * 2654435769u) & mask;; index = (index + 1) & mask) {
+    if (!table->slots[index] || table->slots[index]->id == id) {
+      return table->slots + index;
+    }
+  }
+}
+
+static void growCredentialTable(struct CredentialTable *table) {
+  struct Credential **slots = table->slots;
+  size_t capacity = table->capacity;
+  table->capacity = capacity ? capacity * 2 : CREDENTIAL_TABLE_INITIAL_CAPACITY;
+  table->slots =
+      allocateHeapMemory(table->capacity * sizeof(struct Credential *));
+  memset(table->slots, 0, table->capacity * sizeof(struct Credential *));
+  for (size_t index = 0; index < capacity; ++index) {
+    if (slots[index]) {
+      *findCredentialSlot(table, slots[index]->id) = slots[index];
+    }
+  }
+  free(slots);
+}
+
+static void growCredentialChunks(struct CredentialTable *table) {
+  /* Old arrays are kept, as threads may still be reading through them. */
+  struct CredentialChunks *previous = table->chunks;
+  size_t capacity =
+      previous ? previous->capacity * 2 : CREDENTIAL_CHUNKS_INITIAL_CAPACITY;
+  struct CredentialChunks *chunks =
+      allocateHeapMemory(sizeof(struct CredentialChunks) +
+                         capacity * sizeof(struct Credential **));
+  chunks->previous = previous;
+  chunks->capacity = capacity;
+  size_t totalChunks = previous ? previous->capacity : 0;
+  if (totalChunks) {
+    memcpy(chunks->chunks, previous->chunks,
+           totalChunks * sizeof(struct Credential **));
+  }
+  memset(chunks->chunks + totalChunks, 0,
+         (capacity - totalChunks) * sizeof(struct Credential **));
+  __atomic_store_n(&table->chunks, chunks, __ATOMIC_RELEASE);
+}
+
+static void freeCredentialTable(struct CredentialTable *table) {
+  free(table->slots);
+  for (size_t index = 0; table->chunks && index < table->chunks->capacity &&
+                         table->chunks->chunks[index];
+       ++index) {
+    free(table->chunks->chunks[index]);
+  }
+  for (struct CredentialChunks *chunks = table->chunks, *previous; chunks;
+       chunks = previous) {
+    previous = chunks->previous;
+    free(chunks);
+  }
+}
+
+static struct Credential *saveCredential(int isUser, unsigned int id,
+                                         const char *name) {
+  struct CredentialTable *table =
+      isUser ? &userCredentialsTable_g : &groupCredentialsTable_g;
+  if (table->use * 4 >= table->capacity * 3) {
+    growCredentialTable(table);
+  }
+  struct Credential **slot = findCredentialSlot(table, id);
+  if (*slot) {
+    return *slot;
+  }
+  struct ArenaAllocator *credentials =
+      isUser ? userCredentialsAllocator_g : groupCredentialsAllocator_g;
+  struct ArenaAllocator *buffer =
+      isUser ? userCredentialsDataAllocator_g : groupCredentialsDataAllocator_g;
+  if (!table->chunks || table->use == table->chunks->capacity *
+                                          CREDENTIAL_CHUNK_CAPACITY) {
+    growCredentialChunks(table);
+  }
+  struct Credential ***chunk =
+      table->chunks->chunks + table->use / CREDENTIAL_CHUNK_CAPACITY;
+  if (!*chunk) {
+    *chunk = allocateHeapMemory(CREDENTIAL_CHUNK_CAPACITY *
+                                sizeof(struct Credential *));
+  }
+  struct Credential *credential = allocateArenaMemory(credentials, 1);
+  (*chunk)[table->use % CREDENTIAL_CHUNK_CAPACITY] = credential;
+  *slot = credential;
+  credential->index = table->use++;
+  credential->id = id;
+  if (!name) {
+    /* Ids without a name are kept, so they are not looked up again. */
+    credential->name.buffer = NULL;
+    credential->name.length = 0;
+    return credential;
+  }
+  credential->name.length = strlen(name);
+  credential->name.buffer =
+      allocateArenaMemory(buffer, credential->name.length + 1);
+  memcpy(credential->name.buffer, name, credential->name.length + 1);
+  return credential;
+}
+
+static void loadCredentialsDatabase(int isUser, const char *path) {
+  FILE *database = fopen(path, "r");
+  if (!database) {
+    throwError("can not open the %s database \"%s\".",
+               isUser ? "passwd" : "group", path);
+  }
+  char *line = NULL;
+  size_t lineSize = 0;
+  while (getline(&line, &lineSize, database) > 0) {
+    /* Both databases start with the fields name:password:id. */
+    char *passwordSeparator = strchr(line, ':');
+    char *idSeparator =
+        passwordSeparator ? strchr(passwordSeparator + 1, ':') : NULL;
+    if (*line == '#' || !idSeparator) {
+      continue;
+    }
+    char *end;
+    unsigned long id = strtoul(idSeparator + 1, &end, 10);
+    if (end == idSeparator + 1 || (*end != ':' && *end != '\n' && *end)) {
+      continue;
+    }
+    *passwordSeparator = 0;
+    saveCredential(isUser, id, line);
+  }
+  free(line);
+  fclose(database);
+}
+
+static void preloadCredentials(int isUser) {
+  /* Enumerated once, as each lookup may be a round trip to LDAP. */
+  struct CredentialTable *table =
+      isUser ? &userCredentialsTable_g : &groupCredentialsTable_g;
+  table->isPreloaded = 1;
+  ++stats_g.totalPreloadedDatabases;
+  if (table->databasePath) {
+    loadCredentialsDatabase(isUser, table->databasePath);
+  } else if (isUser) {
+    setpwent();
+    for (struct passwd *user; (user = getpwent());) {
+      saveCredential(1, user->pw_uid, user->pw_name);
+    }
+    endpwent();
+  } else {
+    setgrent();
+    for (struct group *group; (group = getgrent());) {
+      saveCredential(0, group->gr_gid, group->gr_name);
+    }
+    endgrent();
+  }
+}
+
+static struct Credential *findCredential(int isUser, unsigned int id) {
+  if (!userCredentialsAllocator_g || !groupCredentialsAllocator_g) {
+    return NULL;
+  }
+  struct CredentialTable *table =
+      isUser ? &userCredentialsTable_g : &groupCredentialsTable_g;
+  if (!table->isPreloaded &&
+      (table->databasePath || credentialsMode_g == CredentialsMode_Preload ||
+       (credentialsMode_g == CredentialsMode_Automatic &&
+        table->use >= CREDENTIALS_PRELOAD_THRESHOLD))) {
+    preloadCredentials(isUser);
+  }
+  struct Credential *credential;
+  if (table->capacity && (credential = *findCredentialSlot(table, id))) {
+    ++stats_g.totalTableCredentialHits;
+    return credential;
+  }
+  const char *name = NULL;
+  stats_g.totalSystemCredentialLookups += !table->databasePath;
+  if (!table->databasePath && isUser) {
+    struct passwd *user = getpwuid(id);
+    name = user ? user->pw_name : NULL;
+  } else if (!table->databasePath) {
+    struct group *group = getgrgid(id);
+    name = group ? group->gr_name : NULL;
+  }
+  return saveCredential(isUser, id, name);
+}
+
+static int openListing(struct Listing *listing, struct Worker *worker,
+                       int parentDescriptor, const char *directoryName,
+                       struct DirectoryScanner *scanner) {
+  createWorkerBuffers(worker);
+  if (!openDirectoryScanner(parentDescriptor, directoryName,
+                            worker->directoryBuffer, scanner)) {
+    /* Only listings are filtered, not the walks measuring directories. */
+    scanner->isFiltered = totalNamePatterns_g || entryTypesMask_g;
+    return 0;
+  }
+  struct stat directoryStat;
+  listing->errorFormat =
+      fstatat(parentDescriptor, directoryName, &directoryStat,
+              parentDescriptor == AT_FDCWD ? 0 : AT_SYMLINK_NOFOLLOW)
+                             ? "can not find the entry \"%s\"."
+                         : S_ISDIR(directoryStat.st_mode)
+                             ? "can not open the directory \"%s\"."
+                             : "the entry \"%s\" is not a directory.";
+  return -1;
+}
+
+static void resetColumnLengths(struct Worker *worker, int totalWorkers) {
+  for (int index = 0; index < totalWorkers; ++index) {
+    worker[index].userColumnLength = 4;
+    worker[index].groupColumnLength = 5;
+    worker[index].sizeColumnLength = 4;
+    worker[index].totalTopEntries = 0;
+  }
+}
+
+static void scanDirectory(struct Listing *listing, struct Worker *worker,
+                          int isPooled) {
+  struct DirectoryScanner scanner;
+  if (openListing(listing, worker, AT_FDCWD, listing->directoryPath,
+                  &scanner)) {
+    return;
+  }
+  scanOpenedDirectory(listing, worker, &scanner, isPooled);
+  closeDirectoryScanner(&scanner);
+}
+
+static void scanOpenedDirectory(struct Listing *listing, struct Worker *worker,
+                                struct DirectoryScanner *scanner,
+                                int isPooled) {
+  struct CacheKey cacheKey;
+  int isCached = cacheDirectoryPath_g && !totalTopEntries_g &&
+                 !totalNamePatterns_g && !entryTypesMask_g &&
+                 !isSizeFiltered_g && !isAgeFiltered_g && !isOwnerFiltered_g &&
+                 !saveCacheKey(scanner->descriptor, &cacheKey);
+  if (!isCached || loadListingCache(listing, worker, &cacheKey)) {
+    readDirectoryEntries(listing, worker, scanner, isPooled);
+    if (isCached) {
+      saveListingCache(listing, &cacheKey);
+    }
+  }
+  if (isMeasuringDirectories_g) {
+    int sizeColumnLength =
+        measureDirectories(worker, scanner->descriptor, listing->entries,
+                           listing->totalEntries, listing->names);
+    SAVE_GREATER(listing->sizeColumnLength, sizeColumnLength);
+  }
+  struct StatsClock clock;
+  startStatsClock(&clock);
+  sortEntries(listing->entries, listing->totalEntries, listing->names);
+  stopStatsClock(worker, StatsPhase_Sort, &clock, 0);
+  if (totalMeasuredTopEntries_g &&
+      listing->totalEntries > totalMeasuredTopEntries_g) {
+    listing->totalEntries = totalMeasuredTopEntries_g;
+    resetColumnLengths(worker, 1);
+    for (size_t index = 0; index < listing->totalEntries; ++index) {
+      saveColumnLengths(worker, listing->entries + index);
+    }
+    listing->userColumnLength = worker->userColumnLength;
+    listing->groupColumnLength = worker->groupColumnLength;
+    listing->sizeColumnLength = worker->sizeColumnLength;
+  }
+}
+
+static void readDirectoryEntries(struct Listing *listing,
+                                 struct Worker *worker,
+                                 struct DirectoryScanner *scanner,
+                                 int isPooled) {
+  int totalWorkers = isPooled ? totalWorkers_g : 1;
+  resetColumnLengths(worker, totalWorkers);
+  for (size_t totalRecords;
+       (totalRecords =
+            scanDirectoryBatch(worker, scanner, DIRECTORY_BATCH_CAPACITY));) {
+    if (isPooled) {
+      runWorkerPool(scanner->descriptor, worker->records, totalRecords);
+    } else {
+      statDirectoryRecords(worker, scanner->descriptor, worker->records,
+                           totalRecords);
+      saveDirectoryRecords(worker, scanner->descriptor, worker->records,
+                           totalRecords);
+    }
+  }
+  if (totalTopEntries_g) {
+    for (int index = 1; index < totalWorkers; ++index) {
+      struct Worker *poolWorker = worker + index;
+      for (size_t offset = 0; offset < poolWorker->totalTopEntries; ++offset) {
+        struct TopEntry *poolEntry = poolWorker->topEntries + offset;
+        struct TopEntry *topEntry =
+            claimTopEntry(worker, &poolEntry->entry, poolEntry->name);
+        if (topEntry && S_ISLNK(poolEntry->entry.mode)) {
+          copyToBuffer(&topEntry->link, &topEntry->linkCapacity,
+                       poolEntry->link, strlen(poolEntry->link) + 1);
+        }
+      }
+    }
+    /* Only the entries kept are measured and sorted. */
+    for (size_t offset = 0; offset < worker->totalTopEntries; ++offset) {
+      struct TopEntry *topEntry = worker->topEntries + offset;
+      struct Entry *entry = allocateArenaMemory(worker->entriesAllocator, 1);
+      *entry = topEntry->entry;
+      entry->nameOffset = saveEntryNames(
+          worker->entriesDataAllocator, topEntry->name,
+          strlen(topEntry->name) + 1,
+          S_ISLNK(entry->mode) ? topEntry->link : NULL);
+      saveColumnLengths(worker, entry);
+    }
+  }
+  listing->userColumnLength = worker->userColumnLength;
+  listing->groupColumnLength = worker->groupColumnLength;
+  listing->sizeColumnLength = worker->sizeColumnLength;
+  for (int index = 1; index < totalWorkers; ++index) {
+    /* Names of other workers are appended, moving their offsets. */
+    struct Worker *poolWorker = worker + index;
+    struct ArenaAllocator *names = poolWorker->entriesDataAllocator;
+    size_t namesOffset = worker->entriesDataAllocator->use;
+    if (namesOffset + names->use > UINT32_MAX) {
+      throwError("can not keep more than %zuB of names in a listing.",
+                 (size_t)UINT32_MAX);
+    }
+    if (names->use) {
+      char *namesEnd =
+          allocateArenaMemory(worker->entriesDataAllocator, names->use);
+      namesEnd += names->use;
+      for (struct ArenaBlock *block = names->block; block;
+           block = block->previous) {
+        namesEnd -= block->use;
+        memcpy(namesEnd, block->buffer, block->use);
+      }
+    }
+    for (struct ArenaBlock *block = poolWorker->entriesAllocator->block; block;
+         block = block->previous) {
+      if (!block->use) {
+        continue;
+      }
+      struct Entry *entries =
+          allocateArenaMemory(worker->entriesAllocator, block->use);
+      memcpy(entries, block->buffer, block->use * sizeof(struct Entry));
+      for (size_t offset = 0; offset < block->use; ++offset) {
+        entries[offset].nameOffset += namesOffset;
+      }
+    }
+    resetArenaAllocator(poolWorker->entriesAllocator);
+    resetArenaAllocator(names);
+    SAVE_GREATER(listing->userColumnLength, poolWorker->userColumnLength);
+    SAVE_GREATER(listing->groupColumnLength, poolWorker->groupColumnLength);
+    SAVE_GREATER(listing->sizeColumnLength, poolWorker->sizeColumnLength);
+  }
+  listing->totalEntries = worker->entriesAllocator->use;
+  listing->entries = compactArenaAllocator(worker->entriesAllocator);
+  listing->names = compactArenaAllocator(worker->entriesDataAllocator);
+}
+
+static void createCacheDirectory(void) {
+  /* DL_CACHE_DIR overrides the directory, mainly for testing. */
+  const char *path = getenv("DL_CACHE_DIR");
+  const char *cacheHomePath = getenv("XDG_CACHE_HOME");
+  const char *homePath = getenv("HOME");
+  cacheDirectoryPath_g = allocateHeapMemory(PATH_MAX);
+  if (path && *path) {
+    snprintf(cacheDirectoryPath_g, PATH_MAX, "%s", path);
+  } else if (cacheHomePath && *cacheHomePath) {
+    mkdir(cacheHomePath, 0700);
+    snprintf(cacheDirectoryPath_g, PATH_MAX, "%s/dl", cacheHomePath);
+  } else if (homePath && *homePath) {
+    snprintf(cacheDirectoryPath_g, PATH_MAX, "%s/.cache", homePath);
+    mkdir(cacheDirectoryPath_g, 0700);
+    snprintf(cacheDirectoryPath_g, PATH_MAX, "%s/.cache/dl", homePath);
+  } else {
+    free(cacheDirectoryPath_g);
+    cacheDirectoryPath_g = NULL;
+    return;
+  }
+  mkdir(cacheDirectoryPath_g, 0700);
+}
+
+static int saveCacheKey(int directoryDescriptor, struct CacheKey *key) {
+  struct stat directoryStat;
+  if (fstat(directoryDescriptor, &directoryStat)) {
+    return -1;
+  }
+  memset(key, 0, sizeof(struct CacheKey));
+  key->device = directoryStat.st_dev;
+  key->inode = directoryStat.st_ino;
+#if defined(__APPLE__)
+  key->modifiedSeconds = directoryStat.st_mtimespec.tv_sec;
+  key->modifiedNanoseconds = directoryStat.st_mtimespec.tv_nsec;
+  key->changedSeconds = directoryStat.st_ctimespec.tv_sec;
+  key->changedNanoseconds = directoryStat.st_ctimespec.tv_nsec;
+#else
+  key->modifiedSeconds = directoryStat.st_mtim.tv_sec;
+  key->modifiedNanoseconds = directoryStat.st_mtim.tv_nsec;
+  key->changedSeconds = directoryStat.st_ctim.tv_sec;
+  key->changedNanoseconds = directoryStat.st_ctim.tv_nsec;
+#endif
+  key->isSizeAllocated = isSizeAllocated_g;
+  return 0;
+}
+
+static int formatCachePath(char *path, const struct CacheKey *key) {
+  /* Leaves room for the suffix of temporary files. */
+  int length = snprintf(path, PATH_MAX, "%s/%llx-%llx", cacheDirectoryPath_g,
+                        (unsigned long long)key->device,
+                        (unsigned long long)key->inode);
+  return length < 0 || length >= PATH_MAX - 8 ? -1 : 0;
+}
+
+static uint64_t hashCacheData(const char *data, size_t size) {
+  /* FNV-1a, enough to catch files cut short or damaged on disk. */
+  uint64_t hash = 14695981039346656037ULL;
+  for (size_t offset = 0; offset < size; ++offset) {
+    hash = (hash ^ (unsigned char)data[offset]) * 1099511628211ULL;
+  }
+  return hash;
+}
+
+static int isCacheValid(const struct CacheHeader *header,
+                        const struct CacheKey *key, size_t fileSize) {
+  size_t contentSize = fileSize - sizeof(struct CacheHeader);
+  if (header->magic != CACHE_MAGIC || header->version != CACHE_VERSION ||
+      header->recordSize != sizeof(struct CacheRecord) ||
+      memcmp(&header->key, key, sizeof(struct CacheKey)) ||
+      header->totalRecords > contentSize / sizeof(struct CacheRecord) ||
+      header->dataSize !=
+          contentSize - header->totalRecords * sizeof(struct CacheRecord) ||
+      (header->dataSize && ((const char *)(header + 1))[contentSize - 1]) ||
+      hashCacheData((const char *)(header + 1), contentSize) !=
+          header->checksum) {
+    return 0;
+  }
+  /* With the data ending in a null, any offset inside it is a valid string. */
+  const struct CacheRecord *records = (const struct CacheRecord *)(header + 1);
+  for (size_t index = 0; index < header->totalRecords; ++index) {
+    const struct CacheRecord *record = records + index;
+    if (record->nameOffset >= header->dataSize ||
+        (record->linkOffset != CACHE_ABSENT_OFFSET &&
+         record->linkOffset >= header->dataSize)) {
+      return 0;
+    }
+  }
+  return 1;
+}
+
+static int loadListingCache(struct Listing *listing, struct Worker *worker,
+                            const struct CacheKey *key) {
+  /* Valid while the times of the directory are unchanged. */
+  char path[PATH_MAX];
+  int descriptor;
+  if (formatCachePath(path, key) ||
+      (descriptor = open(path, O_RDONLY | O_CLOEXEC)) < 0) {
+    return -1;
+  }
+  struct stat cacheStat;
+  void *mapping =
+      fstat(descriptor, &cacheStat) ||
+              cacheStat.st_size < (off_t)sizeof(struct CacheHeader)
+          ? MAP_FAILED
+          : mmap(NULL, cacheStat.st_size, PROT_READ, MAP_PRIVATE, descriptor,
+                 0);
+  close(descriptor);
+  if (mapping == MAP_FAILED) {
+    return -1;
+  }
+  const struct CacheHeader *header = mapping;
+  if (!isCacheValid(header, key, cacheStat.st_size)) {
+    munmap(mapping, cacheStat.st_size);
+    return -1;
+  }
+  const struct CacheRecord *records = (const struct CacheRecord *)(header + 1);
+  const char *data = (const char *)(records + header->totalRecords);
+  resetColumnLengths(worker, 1);
+  for (size_t index = 0; index < header->totalRecords; ++index) {
+    const struct CacheRecord *record = records + index;
+    struct Entry *entry = allocateArenaMemory(worker->entriesAllocator, 1);
+    const char *name = data + record->nameOffset;
+    const char *link = record->linkOffset == CACHE_ABSENT_OFFSET
+                           ? ""
+                           : data + record->linkOffset;
+    entry->nameOffset =
+        saveEntryNames(worker->entriesDataAllocator, name, strlen(name) + 1,
+                       S_ISLNK(record->mode) ? link : NULL);
+    entry->userIndex = record->userId == UNKNOWN_ID
+                           ? UNKNOWN_CREDENTIAL
+                           : findWorkerCredential(worker, 1, record->userId);
+    entry->groupIndex = record->groupId == UNKNOWN_ID
+                            ? UNKNOWN_CREDENTIAL
+                            : findWorkerCredential(worker, 0, record->groupId);
+    entry->size = record->size;
+    entry->modifiedTime = record->modifiedTime;
+    entry->mode = record->mode;
+    entry->hasSize = record->hasSize;
+    saveColumnLengths(worker, entry);
+  }
+  munmap(mapping, cacheStat.st_size);
+  listing->userColumnLength = worker->userColumnLength;
+  listing->groupColumnLength = worker->groupColumnLength;
+  listing->sizeColumnLength = worker->sizeColumnLength;
+  listing->totalEntries = worker->entriesAllocator->use;
+  listing->entries = compactArenaAllocator(worker->entriesAllocator);
+  listing->names = compactArenaAllocator(worker->entriesDataAllocator);
+  return 0;
+}
+
+static uint32_t appendCacheString(char *data, uint32_t *dataSize,
+                                  const char *string, size_t length) {
+  uint32_t offset = *dataSize;
+  memcpy(data + offset, string, length + 1);
+  *dataSize += length + 1;
+  return offset;
+}
+
+static void saveListingCache(const struct Listing *listing,
+                             const struct CacheKey *key) {
+  /* Changes within the same second may not move the times. */
+  char path[PATH_MAX];
+  time_t racyTime = time(NULL) - 1;
+  if (key->modifiedSeconds >= racyTime || key->changedSeconds >= racyTime ||
+      formatCachePath(path, key)) {
+    return;
+  }
+  size_t dataCapacity = 0;
+  for (size_t index = 0; index < listing->totalEntries; ++index) {
+    dataCapacity += measureEntryNames(listing->names, listing->entries + index);
+  }
+  if (dataCapacity >= CACHE_ABSENT_OFFSET) {
+    return;
+  }
+  size_t recordsSize = listing->totalEntries * sizeof(struct CacheRecord);
+  char *buffer = allocateHeapMemory(sizeof(struct CacheHeader) + recordsSize +
+                                    dataCapacity);
+  struct CacheHeader *header = (struct CacheHeader *)buffer;
+  struct CacheRecord *records = (struct CacheRecord *)(header + 1);
+  char *data = (char *)(records + listing->totalEntries);
+  uint32_t dataSize = 0;
+  for (size_t index = 0; index < listing->totalEntries; ++index) {
+    struct Entry *entry = listing->entries + index;
+    struct CacheRecord *record = records + index;
+    struct Credential *user = findIndexedCredential(1, entry->userIndex);
+    struct Credential *group = findIndexedCredential(0, entry->groupIndex);
+    const char *name = listing->names + entry->nameOffset;
+    const char *link = findEntryLink(listing->names, entry);
+    record->size = entry->size;
+    record->modifiedTime = entry->modifiedTime;
+    record->mode = entry->mode;
+    record->hasSize = entry->hasSize;
+    record->userId = user ? user->id : UNKNOWN_ID;
+    record->groupId = group ? group->id : UNKNOWN_ID;
+    record->nameOffset = appendCacheString(data, &dataSize, name, strlen(name));
+    record->linkOffset =
+        link ? appendCacheString(data, &dataSize, link, strlen(link))
+             : CACHE_ABSENT_OFFSET;
+  }
+  header->magic = CACHE_MAGIC;
+  header->version = CACHE_VERSION;
+  header->recordSize = sizeof(struct CacheRecord);
+  header->key = *key;
+  header->totalRecords = listing->totalEntries;
+  header->dataSize = dataSize;
+  header->checksum =
+      hashCacheData((const char *)records, recordsSize + dataSize);
+  /* Written aside and renamed, so no run reads a partial cache. */
+  size_t fileSize = sizeof(struct CacheHeader) + recordsSize + dataSize;
+  char temporaryPath[PATH_MAX];
+  size_t pathLength = strlen(path);
+  memcpy(temporaryPath, path, pathLength);
+  memcpy(temporaryPath + pathLength, ".XXXXXX", 8);
+  int descriptor = mkstemp(temporaryPath);
+  if (descriptor >= 0) {
+    size_t totalWritten = 0;
+    for (ssize_t written;
+         totalWritten < fileSize &&
+         (written = write(descriptor, buffer + totalWritten,
+                          fileSize - totalWritten)) > 0;) {
+      totalWritten += written;
+    }
+    close(descriptor);
+    if (totalWritten < fileSize || rename(temporaryPath, path)) {
+      unlink(temporaryPath);
+    }
+  }
+  free(buffer);
+}
+
+static uint64_t loadNameChunk(const char *name) {
+  /* Big endian, so chunks compare as strcmp does. */
+  uint64_t chunk = 0;
+  for (int index = 0; index < 8 && name[index]; ++index) {
+    chunk |= (uint64_t)(unsigned char)name[index] << (56 - index * 8);
+  }
+  return chunk;
+}
+
+static int compareNameKeys(const struct SortKey *keyI,
+                           const struct SortKey *keyII, size_t depth,
+                           const char *names) {
+  if (keyI->key != keyII->key) {
+    return keyI->key < keyII->key ? -1 : 1;
+  }
+  /* Equal chunks ending in a zero byte mean the names have ended. */
+  return keyI->key & 255 ? strcmp(names + keyI->nameOffset + depth + 8,
+                                  names + keyII->nameOffset + depth + 8)
+                         : 0;
+}
+
+static void sortKeysByRadix(struct SortKey *keys, struct SortKey *buffer,
+                            size_t totalKeys) {
+  size_t counts[8][256] = {{0}};
+  for (size_t index = 0; index < totalKeys; ++index) {
+    for (int digit = 0; digit < 8; ++digit) {
+      ++counts[digit][keys[index].key >> digit * 8 & 255];
+    }
+  }
+  struct SortKey *source = keys;
+  struct SortKey *destination = buffer;
+  for (int digit = 0; digit < 8; ++digit) {
+    /* Skips the digits all keys share, like the padding of short names. */
+    if (counts[digit][source->key >> digit * 8 & 255] == totalKeys) {
+      continue;
+    }
+    size_t offset = 0;
+    for (int value = 0; value < 256; ++value) {
+      size_t count = counts[digit][value];
+      counts[digit][value] = offset;
+      offset += count;
+    }
+    for (size_t index = 0; index < totalKeys; ++index) {
+      destination[counts[digit][source[index].key >> digit * 8 & 255]++] =
+          source[index];
+    }
+    struct SortKey *swap = source;
+    source = destination;
+    destination = swap;
+  }
+  if (source != keys) {
+    memcpy(keys, source, totalKeys * sizeof(struct SortKey));
+  }
+}
+
+static void sortNameKeys(struct SortKey *keys, struct SortKey *buffer,
+                         size_t totalKeys, size_t depth, const char *names) {
+  if (totalKeys < SORT_INSERTION_THRESHOLD) {
+    for (size_t index = 1; index < totalKeys; ++index) {
+      struct SortKey key = keys[index];
+      size_t offset = index;
+      for (;
+           offset && compareNameKeys(&key, keys + offset - 1, depth, names) < 0;
+           --offset) {
+        keys[offset] = keys[offset - 1];
+      }
+      keys[offset] = key;
+    }
+    return;
+  }
+  sortKeysByRadix(keys, buffer, totalKeys);
+  /* Keys sharing a chunk are sorted again by the next one. */
+  for (size_t start = 0, end; start < totalKeys; start = end) {
+    for (end = start + 1; end < totalKeys && keys[end].key == keys[start].key;
+         ++end) {
+    }
+    if (end - start < 2 || !(keys[start].key & 255)) {
+      continue;
+    }
+    for (size_t index = start; index < end; ++index) {
+      keys[index].key =
+          loadNameChunk(names + keys[index].nameOffset + depth + 8);
+    }
+    sortNameKeys(keys + start, buffer, end - start, depth + 8, names);
+  }
+}
+
+static void sortNumericKeys(struct SortKey *keys, struct SortKey *buffer,
+                            size_t totalKeys, const char *names) {
+  if (totalKeys < SORT_INSERTION_THRESHOLD) {
+    for (size_t index = 1; index < totalKeys; ++index) {
+      struct SortKey key = keys[index];
+      size_t offset = index;
+      for (; offset && (key.key < keys[offset - 1].key ||
+                        (key.key == keys[offset - 1].key &&
+                         strcmp(names + key.nameOffset,
+                                names + keys[offset - 1].nameOffset) < 0));
+           --offset) {
+        keys[offset] = keys[offset - 1];
+      }
+      keys[offset] = key;
+    }
+    return;
+  }
+  sortKeysByRadix(keys, buffer, totalKeys);
+  /* Ties are sorted by name, as the name sort does. */
+  for (size_t start = 0, end; start < totalKeys; start = end) {
+    for (end = start + 1; end < totalKeys && keys[end].key == keys[start].key;
+         ++end) {
+    }
+    if (end - start < 2) {
+      continue;
+    }
+    for (size_t index = start; index < end; ++index) {
+      keys[index].key = loadNameChunk(names + keys[index].nameOffset);
+    }
+    sortNameKeys(keys + start, buffer, end - start, 0, names);
+  }
+}
+
+static int compareVersions(const char *nameI, const char *nameII) {
+  /* Runs of digits compare by value, so "file9" precedes "file10". */
+  const char *characterI = nameI;
+  const char *characterII = nameII;
+  while (*characterI && *characterII) {
+    if (*characterI < '0' || *characterI > '9' || *characterII < '0' ||
+        *characterII > '9') {
+      if (*characterI != *characterII) {
+        return (unsigned char)*characterI < (unsigned char)*characterII ? -1
+                                                                        : 1;
+      }
+      ++characterI;
+      ++characterII;
+      continue;
+    }
+    while (*characterI == '0') {
+      ++characterI;
+    }
+    while (*characterII == '0') {
+      ++characterII;
+    }
+    size_t totalDigitsI = 0;
+    size_t totalDigitsII = 0;
+    while (characterI[totalDigitsI] >= '0' && characterI[totalDigitsI] <= '9') {
+      ++totalDigitsI;
+    }
+    while (characterII[totalDigitsII] >= '0' &&
+           characterII[totalDigitsII] <= '9') {
+      ++totalDigitsII;
+    }
+    if (totalDigitsI != totalDigitsII) {
+      return totalDigitsI < totalDigitsII ? -1 : 1;
+    }
+    int difference = memcmp(characterI, characterII, totalDigitsI);
+    if (difference) {
+      return difference;
+    }
+    characterI += totalDigitsI;
+    characterII += totalDigitsII;
+  }
+  if (*characterI || *characterII) {
+    return *characterI ? 1 : -1;
+  }
+  /* Names equal but for leading zeros are kept in byte order. */
+  return strcmp(nameI, nameII);
+}
+
+static void sortVersionKeys(struct SortKey *keys, struct SortKey *buffer,
+                            size_t totalKeys, const char *names) {
+  if (totalKeys < SORT_INSERTION_THRESHOLD) {
+    for (size_t index = 1; index < totalKeys; ++index) {
+      struct SortKey key = keys[index];
+      size_t offset = index;
+      for (; offset && compareVersions(names + key.nameOffset,
+                                       names + keys[offset - 1].nameOffset) < 0;
+           --offset) {
+        keys[offset] = keys[offset - 1];
+      }
+      keys[offset] = key;
+    }
+    return;
+  }
+  size_t totalKeysI = totalKeys / 2;
+  sortVersionKeys(keys, buffer, totalKeysI, names);
+  sortVersionKeys(keys + totalKeysI, buffer, totalKeys - totalKeysI, names);
+  memcpy(buffer, keys, totalKeysI * sizeof(struct SortKey));
+  size_t offsetI = 0;
+  size_t offsetII = totalKeysI;
+  size_t offset = 0;
+  while (offsetI < totalKeysI && offsetII < totalKeys) {
+    keys[offset++] = compareVersions(names + keys[offsetII].nameOffset,
+                                     names + buffer[offsetI].nameOffset) < 0
+                         ? keys[offsetII++]
+                         : buffer[offsetI++];
+  }
+  memcpy(keys + offset, buffer + offsetI,
+         (totalKeysI - offsetI) * sizeof(struct SortKey));
+}
+
+static void sortEntries(struct Entry *entries, size_t totalEntries,
+                        const char *names) {
+  /* Numbers are complemented so the largest and newest come first. */
+  if (totalEntries < 2) {
+    return;
+  }
+  struct SortKey *keys =
+      allocateHeapMemory(totalEntries * 2 * sizeof(struct SortKey));
+  for (size_t index = 0; index < totalEntries; ++index) {
+    struct Entry *entry = entries + index;
+    if (sortKind_g == SortKind_Name) {
+      keys[index].key = loadNameChunk(names + entry->nameOffset);
+    } else if (sortKind_g == SortKind_Size) {
+      keys[index].key = ~(uint64_t)(entry->hasSize ? entry->size : 0);
+    } else if (sortKind_g == SortKind_ModifiedTime) {
+      /* Flips the sign bit so negative times compare as smaller. */
+      keys[index].key = ~((uint64_t)entry->modifiedTime ^ (uint64_t)1 << 63);
+    } else {
+      keys[index].key = 0;
+    }
+    keys[index].nameOffset = entry->nameOffset;
+    keys[index].index = index;
+  }
+  struct SortKey *buffer = keys + totalEntries;
+  if (sortKind_g == SortKind_Name) {
+    sortNameKeys(keys, buffer, totalEntries, 0, names);
+  } else if (sortKind_g == SortKind_Version) {
+    sortVersionKeys(keys, buffer, totalEntries, names);
+  } else {
+    sortNumericKeys(keys, buffer, totalEntries, names);
+  }
+  struct Entry *sortedEntries =
+      allocateHeapMemory(totalEntries * sizeof(struct Entry));
+  for (size_t index = 0; index < totalEntries; ++index) {
+    sortedEntries[isSortReversed_g ? totalEntries - 1 - index : index] =
+        entries[keys[index].index];
+  }
+  memcpy(entries, sortedEntries, totalEntries * sizeof(struct Entry));
+  free(sortedEntries);
+  free(keys);
+}
+
+static long findUTCOffset(struct DateCache *cache, time_t time) {
+  for (int index = 0; index < cache->totalSegments; ++index) {
+    struct UTCOffsetSegment *segment = cache->segments + index;
+    if (time >= segment->start && time <= segment->end) {
+      return segment->utcOffset;
+    }
+  }
+  struct tm localTime;
+  long utcOffset = localtime_r(&time, &localTime) ? localTime.tm_gmtoff : 0;
+  /* Offsets rarely change, so a close segment with one is extended. */
+  for (int index = 0; index < cache->totalSegments; ++index) {
+    struct UTCOffsetSegment *segment = cache->segments + index;
+    if (segment->utcOffset != utcOffset) {
+      continue;
+    }
+    if (time < segment->start &&
+        segment->start - time <= UTC_OFFSET_MAXIMUM_GAP) {
+      segment->start = time;
+      return utcOffset;
+    }
+    if (time > segment->end && time - segment->end <= UTC_OFFSET_MAXIMUM_GAP) {
+      segment->end = time;
+      return utcOffset;
+    }
+  }
+  struct UTCOffsetSegment *segment = cache->segments + cache->nextSegment;
+  cache->nextSegment = (cache->nextSegment + 1) % UTC_OFFSET_SEGMENTS_CAPACITY;
+  if (cache->totalSegments < UTC_OFFSET_SEGMENTS_CAPACITY) {
+    ++cache->totalSegments;
+  }
+  segment->start = time;
+  segment->end = time;
+  segment->utcOffset = utcOffset;
+  return utcOffset;
+}
+
+static struct DateCacheSlot *findModifiedDate(struct DateCache *cache,
+                                              time_t time, int *dayMinutes) {
+  long long localTime = (long long)time + findUTCOffset(cache, time);
+  long long day = localTime / SECONDS_PER_DAY -
+                  (localTime % SECONDS_PER_DAY < 0);
+  *dayMinutes = (localTime - day * SECONDS_PER_DAY) / 60;
+  struct DateCacheSlot *slot =
+      cache->slots + (unsigned long long)day % DATE_CACHE_CAPACITY;
+  if (slot->isUsed && slot->day == day) {
+    return slot;
+  }
+  /* Converts the days since the epoch to a date of the Gregorian calendar. */
+  long long shiftedDay = day + 719468;
+  long long era = (shiftedDay >= 0 ? shiftedDay : shiftedDay - 146096) / 146097;
+  long long dayOfEra = shiftedDay - era * 146097;
+  long long yearOfEra =
+      (dayOfEra - dayOfEra / 1460 + dayOfEra / 36524 - dayOfEra / 146096) / 365;
+  long long dayOfYear =
+      dayOfEra - (365 * yearOfEra + yearOfEra / 4 - yearOfEra / 100);
+  long long shiftedMonth = (5 * dayOfYear + 2) / 153;
+  int monthDay = dayOfYear - (153 * shiftedMonth + 2) / 5 + 1;
+  int month = shiftedMonth < 10 ? shiftedMonth + 2 : shiftedMonth - 10;
+  long long year = yearOfEra + era * 400 + (month < 2);
+  static const char months[] = "JanFebMarAprMayJunJulAugSepOctNovDec";
+  memcpy(slot->text, months + month * 3, 3);
+  slot->text[3] = '/';
+  slot->text[4] = '0' + monthDay / 10;
+  slot->text[5] = '0' + monthDay % 10;
+  slot->text[6] = '/';
+  if (year >= 0 && year <= 9999) {
+    for (int index = 10; index >= 7; --index, year /= 10) {
+      slot->text[index] = '0' + year % 10;
+    }
+    slot->length = 11;
+  } else {
+    slot->length = 7 + snprintf(slot->text + 7, sizeof(slot->text) - 7,
+                                "%04lld", year);
+  }
+  slot->day = day;
+  slot->isUsed = 1;
+  return slot;
+}
+
+static void formatListingHeader(struct Listing *listing,
+                                struct Worker *worker) {
+  if (outputFormat_g != OutputFormat_Table) {
+    return;
+  }
+  struct OutputBuffer *output = &listing->output;
+  int indexColumnLength = listing->indexColumnLength;
+  int userColumnLength = listing->userColumnLength;
+  int groupColumnLength = listing->groupColumnLength;
+  int sizeColumnLength = listing->sizeColumnLength;
+  appendOutputEscape(output, ansiColorEscapes_g[tmk_AnsiColor_DarkYellow]);
+  if (isOutputColored_g) {
+    appendOutputString(output, " ");
+  }
+  appendOutputEscape(output, ANSI_RESET_COLORS);
+  appendOutputEscape(output, ANSI_BOLD);
+  if (listing->isPathResolved) {
+    appendOutputString(output, listing->directoryPath);
+  } else {
+    char *directoryFullPath =
+        allocateArenaMemory(worker->entriesDataAllocator, PATH_MAX);
+    realpath(listing->directoryPath, directoryFullPath);
+    appendOutputString(output, directoryFullPath);
+    freeArenaMemory(worker->entriesDataAllocator, PATH_MAX);
+  }
+  appendOutputString(output, ":\n");
+  appendOutputEscape(output, ANSI_RESET_WEIGHT);
+  appendOutputEscape(output, ANSI_BOLD);
+  appendOutputPadded(output, "No.", indexColumnLength, 1);
+  appendOutputString(output, " ");
+  appendOutputPadded(output, "Group", groupColumnLength, 0);
+  appendOutputString(output, " ");
+  appendOutputPadded(output, "User", userColumnLength, 0);
+  appendOutputString(output, " Modified Date     ");
+  appendOutputPadded(output, "Size", sizeColumnLength, 1);
+  appendOutputString(output, " Mode          Name\n");
+  appendOutputEscape(output, ANSI_RESET_WEIGHT);
+  int columnLengths[] = {indexColumnLength, groupColumnLength, userColumnLength,
+                         17, sizeColumnLength, 13, 20};
+  for (size_t index = 0; index < 7; ++index) {
+    appendOutputCharacters(output, '-', columnLengths[index]);
+    appendOutputString(output, index < 6 ? " " : "\n");
+  }
+}
+
+static void formatEntry(struct Listing *listing, const struct Entry *entry,
+                        size_t number, struct Worker *worker) {
+  if (outputFormat_g != OutputFormat_Table) {
+    formatRecord(listing, entry);
+    return;
+  }
+  struct OutputBuffer *output = &listing->output;
+  int userColumnLength = listing->userColumnLength;
+  int groupColumnLength = listing->groupColumnLength;
+  int sizeColumnLength = listing->sizeColumnLength;
+  appendOutputNumber(output, number, 10, listing->indexColumnLength, ' ');
+  appendOutputString(output, " ");
+  struct Credential *user = findIndexedCredential(1, entry->userIndex);
+  struct Credential *group = findIndexedCredential(0, entry->groupIndex);
+  if (group && group->name.buffer) {
+    appendOutputEscape(output, ansiColorEscapes_g[tmk_AnsiColor_DarkRed]);
+    appendOutputPadded(output, group->name.buffer, groupColumnLength, 0);
+  } else {
+    appendOutputPadded(output, "-", groupColumnLength, 0);
+  }
+  appendOutputString(output, " ");
+  if (user && user->name.buffer) {
+    appendOutputEscape(output, ansiColorEscapes_g[tmk_AnsiColor_DarkGreen]);
+    appendOutputPadded(output, user->name.buffer, userColumnLength, 0);
+  } else {
+    appendOutputEscape(output, ANSI_RESET_COLORS);
+    appendOutputPadded(output, "-", userColumnLength, 0);
+  }
+  appendOutputString(output, " ");
+  int dayMinutes;
+  struct DateCacheSlot *modifiedDate =
+      findModifiedDate(&worker->dateCache, entry->modifiedTime, &dayMinutes);
+  appendOutputEscape(output, ansiColorEscapes_g[tmk_AnsiColor_DarkYellow]);
+  appendOutput(output, modifiedDate->text, modifiedDate->length);
+  appendOutputString(output, " ");
+  appendOutputEscape(output, ansiColorEscapes_g[tmk_AnsiColor_DarkMagenta]);
+  appendOutputNumber(output, dayMinutes / 60, 10, 2, '0');
+  appendOutputString(output, ":");
+  appendOutputNumber(output, dayMinutes % 60, 10, 2, '0');
+  appendOutputString(output, " ");
+  if (entry->hasSize) {
+    char size[SIZE_BUFFER_SIZE];
+    formatSize(size, entry->size);
+    appendOutputEscape(output, ansiColorEscapes_g[tmk_AnsiColor_DarkRed]);
+    appendOutputPadded(output, size, sizeColumnLength, 1);
+  } else {
+    appendOutputEscape(output, ANSI_RESET_COLORS);
+    appendOutputPadded(output, "-", sizeColumnLength, 1);
+  }
+  appendOutputString(output, " ");
+  const struct Permissions *permissions = permissions_g + (entry->mode & 0777);
+  if (isOutputColored_g) {
+    appendOutput(output, permissions->colored, permissions->coloredLength);
+  } else {
+    appendOutput(output, permissions->plain, PERMISSIONS_PLAIN_LENGTH);
+  }
+  const struct EntryType *type = entryTypes_g + ((entry->mode & S_IFMT) >> 12);
+  if (!type->letter) {
+    type = entryTypes_g + (S_IFSOCK >> 12);
+  }
+  appendOutputEscape(output, type->escape);
+  appendOutputString(output, isOutputColored_g ? type->icon : type->letter);
+  appendOutputEscape(output, ANSI_RESET_COLORS);
+  appendOutputString(output, listing->names + entry->nameOffset);
+  const char *link = findEntryLink(listing->names, entry);
+  if (link) {
+    appendOutputEscape(output, ansiColorEscapes_g[tmk_AnsiColor_LightBlack]);
+    appendOutputString(output, " -> ");
+    appendOutputEscape(output, ANSI_RESET_COLORS);
+    appendOutputString(output, link);
+  }
+  appendOutputString(output, "\n");
+}
+
+static void formatEmptyListing(struct Listing *listing) {
+  if (outputFormat_g != OutputFormat_Table) {
+    return;
+  }
+  struct OutputBuffer *output = &listing->output;
+  appendOutputEscape(output, ansiColorEscapes_g[tmk_AnsiColor_LightBlack]);
+  appendOutputPadded(output, "DIRECTORY IS EMPTY",
+                     29 + listing->indexColumnLength +
+                         listing->groupColumnLength +
+                         listing->userColumnLength + listing->sizeColumnLength,
+                     1);
+  appendOutputString(output, "\n");
+  appendOutputEscape(output, ANSI_RESET_COLORS);
+}
+
+static const char *findRecordEscape(unsigned char character, char *buffer) {
+  if (outputFormat_g == OutputFormat_CSV) {
+    return character == '"' ? "\"\"" : NULL;
+  }
+  if (outputFormat_g == OutputFormat_TSV && character != '\\' &&
+      character != '\t' && character != '\n' && character != '\r') {
+    return NULL;
+  }
+  switch (character) {
+  case '"':
+    return outputFormat_g == OutputFormat_JSONLines ? "\\\"" : NULL;
+  case '\\':
+    return "\\\\";
+  case '\t':
+    return "\\t";
+  case '\n':
+    return "\\n";
+  case '\r':
+    return "\\r";
+  }
+  if (character >= 0x20) {
+    return NULL;
+  }
+  snprintf(buffer, 7, "\\u%04x", character);
+  return buffer;
+}
+
+static size_t measureUTF8Character(const char *string) {
+  /* Returns the size of the UTF-8 character string starts with, or 0. */
+  const unsigned char *bytes = (const unsigned char *)string;
+  size_t size = bytes[0] >= 0xf0 ? 4 : bytes[0] >= 0xe0 ? 3 : 2;
+  if (bytes[0] < 0xc2 || bytes[0] > 0xf4) {
+    return 0;
+  }
+  unsigned char minimum = bytes[0] == 0xe0   ? 0xa0
+                          : bytes[0] == 0xf0 ? 0x90
+                                             : 0x80;
+  unsigned char maximum = bytes[0] == 0xed   ? 0x9f
+                          : bytes[0] == 0xf4 ? 0x8f
+                                             : 0xbf;
+  for (size_t offset = 1; offset < size; ++offset) {
+    if (bytes[offset] < minimum || bytes[offset] > maximum) {
+      return 0;
+    }
+    minimum = 0x80;
+    maximum = 0xbf;
+  }
+  return size;
+}
+
+static int isUTF8String(const char *string) {
+  for (size_t size; *string; string += size) {
+    size = (unsigned char)*string < 0x80 ? 1 : measureUTF8Character(string);
+    if (!size) {
+      return 0;
+    }
+  }
+  return 1;
+}
+
+static void appendRecordString(struct OutputBuffer *output,
+                               const char *string) {
+  if (outputFormat_g == OutputFormat_NUL) {
+    appendOutputString(output, string);
+    return;
+  }
+  int isQuoted = outputFormat_g == OutputFormat_JSONLines ||
+                 (outputFormat_g == OutputFormat_CSV &&
+                  string[strcspn(string, ",\"\r\n")]);
+  if (isQuoted) {
+    appendOutputString(output, "\"");
+  }
+  const char *run = string;
+  const char *cursor = string;
+  for (char buffer[7]; *cursor;) {
+    const char *escape = findRecordEscape(*cursor, buffer);
+    if (escape) {
+      appendOutput(output, run, cursor - run);
+      appendOutputString(output, escape);
+      run = cursor + 1;
+    }
+    ++cursor;
+  }
+  appendOutput(output, run, cursor - run);
+  if (isQuoted) {
+    appendOutputString(output, "\"");
+  }
+}
+
+static void appendRecordBase64(struct OutputBuffer *output,
+                               const char *string) {
+  static const char digits[] =
+      "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+  const unsigned char *bytes = (const unsigned char *)string;
+  size_t length = strlen(string);
+  appendOutputString(output, "\"");
+  for (size_t offset = 0; offset < length; offset += 3) {
+    size_t totalBytes = length - offset < 3 ? length - offset : 3;
+    unsigned long group = (unsigned long)bytes[offset] << 16;
+    group |= totalBytes > 1 ? (unsigned long)bytes[offset + 1] << 8 : 0;
+    group |= totalBytes > 2 ? bytes[offset + 2] : 0;
+    char quantum[4] = {digits[group >> 18 & 63], digits[group >> 12 & 63],
+                       totalBytes > 1 ? digits[group >> 6 & 63] : '=',
+                       totalBytes > 2 ? digits[group & 63] : '='};
+    appendOutput(output, quantum, 4);
+  }
+  appendOutputString(output, "\"");
+}
+
+static void appendRecordField(struct OutputBuffer *output, const char *key,
+                              int isFirst) {
+  if (outputFormat_g == OutputFormat_JSONLines) {
+    appendOutputString(output, isFirst ? "{\"" : ",\"");
+    appendOutputString(output, key);
+    appendOutputString(output, "\":");
+  } else if (!isFirst) {
+    appendOutput(output,
+                 outputFormat_g == OutputFormat_CSV   ? ","
+                 : outputFormat_g == OutputFormat_TSV ? "\t"
+                                                      : "",
+                 1);
+  }
+}
+
+static void appendRecordNull(struct OutputBuffer *output) {
+  if (outputFormat_g == OutputFormat_JSONLines) {
+    appendOutputString(output, "null");
+  }
+}
+
+static void appendRecordText(struct OutputBuffer *output, const char *key,
+                             const char *string, int isFirst) {
+  /* JSON strings must be UTF-8, so other bytes are given in base64 aside. */
+  appendRecordField(output, key, isFirst);
+  if (outputFormat_g != OutputFormat_JSONLines || isUTF8String(string)) {
+    appendRecordString(output, string);
+    return;
+  }
+  appendRecordNull(output);
+  appendOutputString(output, ",\"");
+  appendOutputString(output, key);
+  appendOutputString(output, "_base64\":");
+  appendRecordBase64(output, string);
+}
+
+static void formatRecord(struct Listing *listing, const struct Entry *entry) {
+  /* Fields not known are null in JSON and empty otherwise. */
+  struct OutputBuffer *output = &listing->output;
+  const struct EntryType *type = entryTypes_g + ((entry->mode & S_IFMT) >> 12);
+  if (!type->letter) {
+    type = entryTypes_g + (S_IFSOCK >> 12);
+  }
+  struct Credential *user = findIndexedCredential(1, entry->userIndex);
+  struct Credential *group = findIndexedCredential(0, entry->groupIndex);
+  const char *link = findEntryLink(listing->names, entry);
+  int isJSON = outputFormat_g == OutputFormat_JSONLines;
+  appendRecordText(output, "directory", listing->directoryPath, 1);
+  appendRecordText(output, "name", listing->names + entry->nameOffset, 0);
+  appendRecordField(output, "type", 0);
+  appendRecordString(output, type->name);
+  appendRecordField(output, "size", 0);
+  if (entry->hasSize) {
+    appendOutputNumber(output, entry->size, 10, 0, ' ');
+  } else {
+    appendRecordNull(output);
+  }
+  appendRecordField(output, "mtime", 0);
+  if (entry->modifiedTime < 0) {
+    appendOutputString(output, "-");
+  }
+  appendOutputNumber(output,
+                     entry->modifiedTime < 0
+                         ? -(unsigned long long)entry->modifiedTime
+                         : (unsigned long long)entry->modifiedTime,
+                     10, 0, ' ');
+  /* JSON numbers can not start with a zero, so the mode is a string there. */
+  appendRecordField(output, "mode", 0);
+  appendOutputString(output, isJSON ? "\"" : "");
+  appendOutputNumber(output, entry->mode & 07777, 8, 4, '0');
+  appendOutputString(output, isJSON ? "\"" : "");
+  appendRecordField(output, "uid", 0);
+  if (user) {
+    appendOutputNumber(output, user->id, 10, 0, ' ');
+  } else {
+    appendRecordNull(output);
+  }
+  if (user && user->name.buffer) {
+    appendRecordText(output, "user", user->name.buffer, 0);
+  } else {
+    appendRecordField(output, "user", 0);
+    appendRecordNull(output);
+  }
+  appendRecordField(output, "gid", 0);
+  if (group) {
+    appendOutputNumber(output, group->id, 10, 0, ' ');
+  } else {
+    appendRecordNull(output);
+  }
+  if (group && group->name.buffer) {
+    appendRecordText(output, "group", group->name.buffer, 0);
+  } else {
+    appendRecordField(output, "group", 0);
+    appendRecordNull(output);
+  }
+  if (link) {
+    appendRecordText(output, "link", link, 0);
+  } else {
+    appendRecordField(output, "link", 0);
+    appendRecordNull(output);
+  }
+  if (outputFormat_g == OutputFormat_NUL) {
+    appendOutput(output, "", 1);
+  } else {
+    appendOutputString(output, isJSON ? "}\n" : "\n");
+  }
+}
+
+static void formatListing(struct Listing *listing, struct Worker *worker) {
+  struct StatsClock clock;
+  startStatsClock(&clock);
+  listing->indexColumnLength = 3;
+  int totalDigitsForIndex = countDigits(listing->totalEntries);
+  SAVE_GREATER(listing->indexColumnLength, totalDigitsForIndex);
+  formatListingHeader(listing, worker);
+  if (!listing->totalEntries) {
+    formatEmptyListing(listing);
+  }
+  for (size_t index = 0; index < listing->totalEntries; ++index) {
+    formatEntry(listing, listing->entries + index, index + 1, worker);
+  }
+  stopStatsClock(worker, StatsPhase_Render, &clock, 0);
+}
+
+static void writeListing(struct Listing *listing) {
+  if (listing->errorFormat) {
+    writeError(listing->errorFormat, listing->directoryPath);
+    return;
+  }
+  flushOutput(&listing->output);
+  free(listing->output.buffer);
+  listing->output.buffer = NULL;
+  listing->output.capacity = 0;
+}
+
+static void createAllocators(void) {
+  createArenaAllocator("entriesAllocator_g", sizeof(struct Entry), 30000,
+                       &entriesAllocator_g);
+  createArenaAllocator("entriesDataAllocator_g", sizeof(char), 2097152,
+                       &entriesDataAllocator_g);
+  createArenaAllocator("temporaryDataAllocator_g", sizeof(char), 500,
+                       &temporaryDataAllocator_g);
+  createArenaAllocator("userCredentialsAllocator_g", sizeof(struct Credential),
+                       20, &userCredentialsAllocator_g);
+  createArenaAllocator("userCredentialsDataAllocator_g", sizeof(char), 320,
+                       &userCredentialsDataAllocator_g);
+  createArenaAllocator("groupCredentialsAllocator_g", sizeof(struct Credential),
+                       20, &groupCredentialsAllocator_g);
+  createArenaAllocator("groupCredentialsDataAllocator_g", sizeof(char), 320,
+                       &groupCredentialsDataAllocator_g);
+  createWorkers();
+  if (isMeasuringDirectories_g) {
+    createSizeWalk();
+  }
+}
+
+static void readDirectory(const char *directoryPath) {
+  struct Listing listing = {.directoryPath = directoryPath};
+  createAllocators();
+  scanDirectory(&listing, workers_g, 1);
+  if (!listing.errorFormat) {
+    formatListing(&listing, workers_g);
+  }
+  writeListing(&listing);
+  resetArenaAllocator(entriesAllocator_g);
+  resetArenaAllocator(entriesDataAllocator_g);
+  for (int index = 1; index < totalWorkers_g; ++index) {
+    resetArenaAllocator(workers_g[index].entriesDataAllocator);
+  }
+}
+
+static void streamDirectory(const char *directoryPath) {
+  /* Column lengths only grow, widening the rows that follow. */
+  struct Listing listing = {.directoryPath = directoryPath};
+  createAllocators();
+  struct DirectoryScanner scanner;
+  if (openListing(&listing, workers_g, AT_FDCWD, directoryPath, &scanner)) {
+    writeListing(&listing);
+    return;
+  }
+  resetColumnLengths(workers_g, totalWorkers_g);
+  listing.userColumnLength = workers_g->userColumnLength;
+  listing.groupColumnLength = workers_g->groupColumnLength;
+  listing.sizeColumnLength = workers_g->sizeColumnLength;
+  listing.indexColumnLength = 3;
+  int isHeaderFormatted = 0;
+  for (size_t totalRecords;
+       (totalRecords =
+            scanDirectoryBatch(workers_g, &scanner, STREAM_BATCH_CAPACITY));) {
+    runWorkerPool(scanner.descriptor, workers_g->records, totalRecords);
+    for (int index = 0; index < totalWorkers_g; ++index) {
+      struct Worker *worker = workers_g + index;
+      if (isMeasuringDirectories_g) {
+        /* The scanner may still need its buffer, so it is left alone. */
+        int sizeColumnLength = measureDirectories(
+            NULL, scanner.descriptor,
+            compactArenaAllocator(worker->entriesAllocator),
+            worker->entriesAllocator->use,
+            compactArenaAllocator(worker->entriesDataAllocator));
+        SAVE_GREATER(listing.sizeColumnLength, sizeColumnLength);
+      }
+      SAVE_GREATER(listing.userColumnLength, worker->userColumnLength);
+      SAVE_GREATER(listing.groupColumnLength, worker->groupColumnLength);
+      SAVE_GREATER(listing.sizeColumnLength, worker->sizeColumnLength);
+    }
+    int totalDigitsForIndex = countDigits(listing.totalEntries + totalRecords);
+    SAVE_GREATER(listing.indexColumnLength, totalDigitsForIndex);
+    struct StatsClock clock;
+    startStatsClock(&clock);
+    if (!isHeaderFormatted) {
+      formatListingHeader(&listing, workers_g);
+      isHeaderFormatted = 1;
+    }
+    for (int index = 0; index < totalWorkers_g; ++index) {
+      struct Worker *worker = workers_g + index;
+      size_t totalEntries = worker->entriesAllocator->use;
+      struct Entry *entries = compactArenaAllocator(worker->entriesAllocator);
+      listing.names = compactArenaAllocator(worker->entriesDataAllocator);
+      for (size_t offset = 0; offset < totalEntries; ++offset) {
+        formatEntry(&listing, entries + offset, ++listing.totalEntries,
+                    workers_g);
+      }
+      resetArenaAllocator(worker->entriesAllocator);
+      resetArenaAllocator(worker->entriesDataAllocator);
+    }
+    stopStatsClock(workers_g, StatsPhase_Render, &clock, 0);
+    flushOutput(&listing.output);
+  }
+  closeDirectoryScanner(&scanner);
+  if (!isHeaderFormatted) {
+    formatListingHeader(&listing, workers_g);
+  }
+  if (!listing.totalEntries) {
+    formatEmptyListing(&listing);
+  }
+  writeListing(&listing);
+}
+
+#if defined(__linux__)
+static void compactWatchedNames(struct Watch *watch) {
+  char *names = allocateHeapMemory(watch->namesCapacity);
+  size_t namesSize = 0;
+  for (size_t index = 0; index < watch->totalEntries; ++index) {
+    struct Entry *entry = watch->entries + index;
+    size_t size = measureEntryNames(watch->names, entry);
+    memcpy(names + namesSize, watch->names + entry->nameOffset, size);
+    entry->nameOffset = namesSize;
+    namesSize += size;
+  }
+  free(watch->names);
+  watch->names = names;
+  watch->namesSize = namesSize;
+  watch->totalUnusedNames = 0;
+  indexWatchedEntries(watch);
+}
+
+static uint32_t saveWatchedNames(struct Watch *watch, const char *names,
+                                 size_t size) {
+  /* Compacted instead of grown once most of its names were removed. */
+  if (watch->namesSize + size > watch->namesCapacity &&
+      watch->totalUnusedNames > watch->namesSize / 2) {
+    compactWatchedNames(watch);
+  }
+  if (watch->namesSize + size > UINT32_MAX) {
+    throwError("can not keep more than %zuB of names in a listing.",
+               (size_t)UINT32_MAX);
+  }
+  if (watch->namesSize + size > watch->namesCapacity) {
+    size_t capacity = watch->namesCapacity ? watch->namesCapacity
+                                           : WATCH_NAMES_INITIAL_CAPACITY;
+    while (capacity < watch->namesSize + size) {
+      capacity *= 2;
+    }
+    char *buffer = realloc(watch->names, capacity);
+    if (!buffer) {
+      throwError("can not allocate %zuB of memory on the heap.", capacity);
+    }
+    watch->names = buffer;
+    watch->namesCapacity = capacity;
+  }
+  uint32_t offset = watch->namesSize;
+  memcpy(watch->names + offset, names, size);
+  watch->namesSize += size;
+  return offset;
+}
+
+static struct Entry *findWatchedSlot(struct Watch *watch, const char *name) {
+  /* Returns the slot of the entry named, or the free one it would take. */
+  size_t mask = watch->slotsCapacity - 1;
+  for (size_t slot = hashCacheData(name, strlen(name)) & mask;;
+       slot = (slot + 1) & mask) {
+    struct Entry *entry = watch->slots + slot;
+    if (entry->nameOffset == WATCH_FREE_SLOT ||
+        !strcmp(watch->names + entry->nameOffset, name)) {
+      return entry;
+    }
+  }
+}
+
+static void indexWatchedEntries(struct Watch *watch) {
+  size_t capacity = WATCH_SLOTS_INITIAL_CAPACITY;
+  while (capacity < watch->totalEntries * 2) {
+    capacity *= 2;
+  }
+  if (capacity != watch->slotsCapacity) {
+    free(watch->slots);
+    watch->slots = allocateHeapMemory(capacity * sizeof(struct Entry));
+    watch->slotsCapacity = capacity;
+  }
+  for (size_t index = 0; index < capacity; ++index) {
+    watch->slots[index].nameOffset = WATCH_FREE_SLOT;
+  }
+  for (size_t index = 0; index < watch->totalEntries; ++index) {
+    struct Entry *entry = watch->entries + index;
+    *findWatchedSlot(watch, watch->names + entry->nameOffset) = *entry;
+  }
+}
+
+static void removeWatchedSlot(struct Watch *watch, struct Entry *slot) {
+  /* Later slots of the probe run are moved back, so no search stops early. */
+  size_t mask = watch->slotsCapacity - 1;
+  size_t hole = slot - watch->slots;
+  for (size_t index = (hole + 1) & mask;
+       watch->slots[index].nameOffset != WATCH_FREE_SLOT;
+       index = (index + 1) & mask) {
+    const char *name = watch->names + watch->slots[index].nameOffset;
+    size_t home = hashCacheData(name, strlen(name)) & mask;
+    if (((index - home) & mask) >= ((index - hole) & mask)) {
+      watch->slots[hole] = watch->slots[index];
+      hole = index;
+    }
+  }
+  watch->slots[hole].nameOffset = WATCH_FREE_SLOT;
+}
+
+static void measureWatchedColumns(struct Entry *entry, int *lengths) {
+  resetColumnLengths(workers_g, 1);
+  if (entry) {
+    saveColumnLengths(workers_g, entry);
+  }
+  lengths[0] = workers_g->userColumnLength;
+  lengths[1] = workers_g->groupColumnLength;
+  lengths[2] = workers_g->sizeColumnLength;
+}
+
+static void loadWatchedColumns(struct Watch *watch) {
+  int lastColumnLengths[3];
+  memcpy(lastColumnLengths, watch->columnLengths, sizeof(lastColumnLengths));
+  measureWatchedColumns(NULL, watch->columnLengths);
+  memset(watch->totalWidestEntries, 0, sizeof(watch->totalWidestEntries));
+  int isRedrawNeeded = watch->isRedrawNeeded;
+  for (size_t index = 0; index < watch->totalEntries; ++index) {
+    saveWatchedColumns(watch, watch->entries + index, 0);
+  }
+  watch->isRedrawNeeded =
+      isRedrawNeeded || memcmp(lastColumnLengths, watch->columnLengths,
+                               sizeof(lastColumnLengths));
+}
+
+static void saveWatchedColumns(struct Watch *watch, struct Entry *entry,
+                               int isRemoved) {
+  /* Columns are only measured again once no widest entry is left. */
+  int lengths[3];
+  measureWatchedColumns(entry, lengths);
+  int isMeasureNeeded = 0;
+  for (int column = 0; column < 3; ++column) {
+    if (lengths[column] > watch->columnLengths[column]) {
+      watch->columnLengths[column] = lengths[column];
+      watch->totalWidestEntries[column] = 1;
+      watch->isRedrawNeeded = 1;
+    } else if (lengths[column] == watch->columnLengths[column] && isRemoved) {
+      isMeasureNeeded |= !--watch->totalWidestEntries[column];
+    } else if (lengths[column] == watch->columnLengths[column]) {
+      ++watch->totalWidestEntries[column];
+    }
+  }
+  if (isMeasureNeeded) {
+    loadWatchedColumns(watch);
+  }
+}
+
+static void markWatchedRow(struct Watch *watch, size_t index) {
+  if (index < watch->firstChangedIndex) {
+    watch->firstChangedIndex = index;
+  }
+  SAVE_GREATER(watch->lastChangedIndex, index);
+}
+
+static int loadWatchedEntries(struct Watch *watch) {
+  /* Scanned names are all in the pool of the first worker. */
+  struct Listing *listing = &watch->listing;
+  watch->totalEntries = 0;
+  watch->namesSize = 0;
+  watch->totalUnusedNames = 0;
+  scanDirectory(listing, workers_g, 1);
+  if (listing->errorFormat) {
+    return -1;
+  }
+  if (listing->totalEntries > watch->entriesCapacity) {
+    free(watch->entries);
+    watch->entriesCapacity = listing->totalEntries;
+    watch->entries =
+        allocateHeapMemory(watch->entriesCapacity * sizeof(struct Entry));
+  }
+  memcpy(watch->entries, listing->entries,
+         listing->totalEntries * sizeof(struct Entry));
+  watch->totalEntries = listing->totalEntries;
+  if (workers_g->entriesDataAllocator->use) {
+    saveWatchedNames(watch, listing->names,
+                     workers_g->entriesDataAllocator->use);
+  }
+  resetArenaAllocator(entriesAllocator_g);
+  resetArenaAllocator(entriesDataAllocator_g);
+  for (int index = 1; index < totalWorkers_g; ++index) {
+    resetArenaAllocator(workers_g[index].entriesDataAllocator);
+  }
+  indexWatchedEntries(watch);
+  loadWatchedColumns(watch);
+  watch->isRedrawNeeded = 1;
+  return 0;
+}
+
+static size_t findWatchedEntry(struct Watch *watch, const struct Entry *entry) {
+  /* Entries equal in the sort order are told apart by name. */
+  const char *name = watch->names + entry->nameOffset;
+  size_t start = 0;
+  size_t end = watch->totalEntries;
+  while (start < end) {
+    size_t middle = start + (end - start) / 2;
+    struct Entry *other = watch->entries + middle;
+    if (compareEntries(other, watch->names + other->nameOffset, entry, name) <
+        0) {
+      start = middle + 1;
     } else {
-      tmk_resetFontColors();
-      tmk_write("%*c ", sizeColumnLength, '-');
+      end = middle;
+    }
+  }
+  while (start < watch->totalEntries &&
+         strcmp(watch->names + watch->entries[start].nameOffset, name)) {
+    ++start;
+  }
+  return start;
+}
+
+static void removeWatchedEntry(struct Watch *watch, const char *name) {
+  struct Entry *slot = findWatchedSlot(watch, name);
+  if (slot->nameOffset == WATCH_FREE_SLOT) {
+    return;
+  }
+  size_t index = findWatchedEntry(watch, slot);
+  removeWatchedSlot(watch, slot);
+  if (index == watch->totalEntries) {
+    return;
+  }
+  struct Entry entry = watch->entries[index];
+  watch->totalUnusedNames += measureEntryNames(watch->names, &entry);
+  memmove(watch->entries + index, watch->entries + index + 1,
+          (--watch->totalEntries - index) * sizeof(struct Entry));
+  markWatchedRow(watch, index);
+  saveWatchedColumns(watch, &entry, 1);
+}
+
+static void saveWatchedEntry(struct Watch *watch, const char *name) {
+  removeWatchedEntry(watch, name);
+  if (totalNamePatterns_g && !isNameIncluded(name, strlen(name))) {
+    return;
+  }
+  struct DirectoryRecord record = {.name = name,
+                                   .nameSize = strlen(name) + 1,
+                                   .type = DT_UNKNOWN};
+  record.isStated = !statDirectoryRecord(watch->directoryDescriptor, &record);
+  if (!record.isStated && errno == ENOENT) {
+    /* Already gone, its removal is among the events still to be read. */
+    return;
+  }
+  if (!record.isStated) {
+    saveUnstatedDirectoryRecord(&record);
+  }
+  saveDirectoryRecords(workers_g, watch->directoryDescriptor, &record, 1);
+  if (!workers_g->entriesAllocator->use) {
+    return;
+  }
+  struct Entry entry = *(struct Entry *)compactArenaAllocator(
+      workers_g->entriesAllocator);
+  const char *names = compactArenaAllocator(workers_g->entriesDataAllocator);
+  entry.nameOffset =
+      saveWatchedNames(watch, names + entry.nameOffset,
+                       measureEntryNames(names, &entry));
+  resetArenaAllocator(workers_g->entriesAllocator);
+  resetArenaAllocator(workers_g->entriesDataAllocator);
+  if (watch->totalEntries == watch->entriesCapacity) {
+    watch->entriesCapacity = watch->entriesCapacity
+                                 ? watch->entriesCapacity * 2
+                                 : WATCH_ENTRIES_INITIAL_CAPACITY;
+    struct Entry *entries = realloc(
+        watch->entries, watch->entriesCapacity * sizeof(struct Entry));
+    if (!entries) {
+      throwError("can not allocate %zuB of memory on the heap.",
+                 watch->entriesCapacity * sizeof(struct Entry));
+    }
+    watch->entries = entries;
+  }
+  /* Placed after its equals, as a binary search in the sort order. */
+  size_t start = 0;
+  size_t end = watch->totalEntries;
+  while (start < end) {
+    size_t middle = start + (end - start) / 2;
+    struct Entry *other = watch->entries + middle;
+    if (compareEntries(&entry, name, other,
+                       watch->names + other->nameOffset) < 0) {
+      end = middle;
+    } else {
+      start = middle + 1;
+    }
+  }
+  memmove(watch->entries + start + 1, watch->entries + start,
+          (watch->totalEntries - start) * sizeof(struct Entry));
+  watch->entries[start] = entry;
+  ++watch->totalEntries;
+  if (watch->totalEntries * 2 > watch->slotsCapacity) {
+    indexWatchedEntries(watch);
+  } else {
+    *findWatchedSlot(watch, name) = entry;
+  }
+  markWatchedRow(watch, start);
+  saveWatchedColumns(watch, &entry, 0);
+}
+
+static int applyWatchEvents(struct Watch *watch) {
+  /* Returns -1 once the directory itself is removed or moved away. */
+  _Alignas(struct inotify_event) char buffer[WATCH_EVENTS_BUFFER_SIZE];
+  int isRescanNeeded = 0;
+  /* inotify does not report its removal while it is open. */
+  watch->directoryDescriptor =
+      open(watch->listing.directoryPath, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+  if (watch->directoryDescriptor < 0) {
+    return -1;
+  }
+  for (ssize_t totalBytes;
+       (totalBytes = read(watch->notifyDescriptor, buffer, sizeof(buffer))) >
+       0;) {
+    for (char *cursor = buffer; cursor < buffer + totalBytes;) {
+      struct inotify_event *event = (struct inotify_event *)cursor;
+      cursor += sizeof(struct inotify_event) + event->len;
+      if (event->mask & (IN_DELETE_SELF | IN_MOVE_SELF | IN_IGNORED)) {
+        close(watch->directoryDescriptor);
+        return -1;
+      }
+      if (event->mask & IN_Q_OVERFLOW) {
+        isRescanNeeded = 1;
+      } else if (isRescanNeeded || !event->len) {
+        continue;
+      } else if (event->mask & (IN_DELETE | IN_MOVED_FROM)) {
+        removeWatchedEntry(watch, event->name);
+      } else {
+        saveWatchedEntry(watch, event->name);
+      }
+    }
+  }
+  close(watch->directoryDescriptor);
+  return isRescanNeeded ? loadWatchedEntries(watch) : 0;
+}
+
+static void formatWatchFrame(struct Watch *watch) {
+  /* Frames for the terminal are formatted by writeWatchFrame, row by row. */
+  struct Listing *listing = &watch->listing;
+  listing->userColumnLength = watch->columnLengths[0];
+  listing->groupColumnLength = watch->columnLengths[1];
+  listing->sizeColumnLength = watch->columnLengths[2];
+  listing->entries = watch->entries;
+  listing->names = watch->names;
+  listing->totalEntries = watch->totalEntries;
+  listing->output.use = 0;
+  if (!isOutputColored_g) {
+    formatListing(listing, workers_g);
+  }
+}
+
+static void appendWatchRows(struct Watch *watch, size_t row, size_t totalRows) {
+  struct OutputBuffer *output = &watch->listing.output;
+  struct OutputBuffer *screen = &watch->screen;
+  const char *outputEnd = output->buffer + output->use;
+  for (const char *line = output->buffer; line < outputEnd && row < totalRows;
+       ++row) {
+    const char *lineEnd = memchr(line, '\n', outputEnd - line);
+    lineEnd = lineEnd ? lineEnd : outputEnd;
+    appendOutputString(screen, "\x1b[");
+    appendOutputNumber(screen, row + 1, 10, 0, ' ');
+    appendOutputString(screen, "H\x1b[0m");
+    appendOutput(screen, line, lineEnd - line);
+    appendOutputString(screen, "\x1b[K");
+    line = lineEnd + 1;
+  }
+  output->use = 0;
+}
+
+static void writeWatchFrame(struct Watch *watch) {
+  /* Rows below the terminal are left out, as scrolling would move others. */
+  struct Listing *listing = &watch->listing;
+  struct OutputBuffer *screen = &watch->screen;
+  struct winsize terminalSize;
+  size_t totalRows =
+      ioctl(STDOUT_FILENO, TIOCGWINSZ, &terminalSize) || !terminalSize.ws_row
+          ? SIZE_MAX
+          : (size_t)terminalSize.ws_row - 1;
+  size_t totalEntries = watch->totalEntries;
+  int indexColumnLength = 3;
+  int totalDigitsForIndex = countDigits(totalEntries);
+  SAVE_GREATER(indexColumnLength, totalDigitsForIndex);
+  size_t start = watch->firstChangedIndex;
+  size_t end = totalEntries == watch->totalDrawnEntries
+                   ? watch->lastChangedIndex + 1
+                   : totalEntries;
+  if (watch->isRedrawNeeded ||
+      indexColumnLength != listing->indexColumnLength ||
+      !totalEntries != !watch->totalDrawnEntries) {
+    listing->indexColumnLength = indexColumnLength;
+    formatListingHeader(listing, workers_g);
+    if (!totalEntries) {
+      formatEmptyListing(listing);
+    }
+    appendWatchRows(watch, 0, totalRows);
+    start = 0;
+    end = totalEntries;
+  }
+  size_t totalEntryRows =
+      totalRows > WATCH_HEADER_ROWS ? totalRows - WATCH_HEADER_ROWS : 0;
+  if (end > totalEntryRows) {
+    end = totalEntryRows;
+  }
+  if (end > totalEntries) {
+    end = totalEntries;
+  }
+  if (start < end) {
+    struct StatsClock clock;
+    startStatsClock(&clock);
+    for (size_t index = start; index < end; ++index) {
+      formatEntry(listing, watch->entries + index, index + 1, workers_g);
+    }
+    stopStatsClock(workers_g, StatsPhase_Render, &clock, 0);
+    appendWatchRows(watch, WATCH_HEADER_ROWS + start, totalRows);
+  }
+  size_t row = WATCH_HEADER_ROWS + (totalEntries ? totalEntries : 1);
+  if (row > totalRows) {
+    row = totalRows;
+  }
+  appendOutputString(screen, "\x1b[");
+  appendOutputNumber(screen, row + 1, 10, 0, ' ');
+  appendOutputString(screen, row < watch->totalDrawnRows ? "H\x1b[J" : "H");
+  flushOutput(screen);
+  watch->totalDrawnRows = row;
+  watch->totalDrawnEntries = totalEntries;
+  watch->firstChangedIndex = SIZE_MAX;
+  watch->lastChangedIndex = 0;
+  watch->isRedrawNeeded = 0;
+}
+
+static void handleWatchSignal(int signal) {
+  watchSignal_g = signal;
+}
+
+static void watchDirectory(const char *directoryPath) {
+  struct Watch watch = {.listing = {.directoryPath = directoryPath},
+                        .firstChangedIndex = SIZE_MAX};
+  createAllocators();
+  watch.notifyDescriptor = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+  /* Subscribed before the scan, so no change made during it is missed. */
+  if (watch.notifyDescriptor < 0 ||
+      inotify_add_watch(watch.notifyDescriptor, directoryPath,
+                        IN_ONLYDIR | IN_CREATE | IN_DELETE | IN_MOVED_FROM |
+                            IN_MOVED_TO | IN_ATTRIB | IN_MODIFY |
+                            IN_DELETE_SELF | IN_MOVE_SELF) < 0) {
+    writeError("can not watch the directory \"%s\".", directoryPath);
+  } else if (!loadWatchedEntries(&watch)) {
+    char *directoryFullPath = allocateHeapMemory(PATH_MAX);
+    if (realpath(directoryPath, directoryFullPath)) {
+      watch.listing.directoryPath = directoryFullPath;
+      watch.listing.isPathResolved = 1;
+    }
+    watch.listing.output.isDeferred = isOutputColored_g;
+    struct sigaction action = {.sa_handler = handleWatchSignal};
+    sigaction(SIGINT, &action, NULL);
+    sigaction(SIGTERM, &action, NULL);
+    sigaction(SIGWINCH, &action, NULL);
+    /* Hides the cursor and stops long rows from wrapping to the next line. */
+    appendOutputEscape(&watch.screen, "\x1b[?25l\x1b[?7l\x1b[H\x1b[2J");
+    for (int isChanged = 1; watchSignal_g != SIGINT &&
+                            watchSignal_g != SIGTERM;) {
+      if (watchSignal_g == SIGWINCH) {
+        watchSignal_g = 0;
+        watch.totalDrawnRows = 0;
+        watch.isRedrawNeeded = 1;
+        appendOutputEscape(&watch.screen, "\x1b[H\x1b[2J");
+        isChanged = 1;
+      }
+      if (isChanged) {
+        formatWatchFrame(&watch);
+        if (isOutputColored_g) {
+          writeWatchFrame(&watch);
+        } else {
+          flushOutput(&watch.listing.output);
+        }
+      }
+      struct pollfd notifyPoll = {.fd = watch.notifyDescriptor,
+                                  .events = POLLIN};
+      isChanged = poll(&notifyPoll, 1, -1) > 0;
+      if (isChanged && applyWatchEvents(&watch)) {
+        writeError("the directory \"%s\" is no longer available.",
+                   directoryPath);
+        break;
+      }
+    }
+    appendOutputEscape(&watch.screen, "\x1b[?7h\x1b[?25h");
+    flushOutput(&watch.screen);
+    free(directoryFullPath);
+  } else {
+    writeListing(&watch.listing);
+  }
+  free(watch.entries);
+  free(watch.slots);
+  free(watch.names);
+  free(watch.listing.output.buffer);
+  free(watch.screen.buffer);
+  if (watch.notifyDescriptor >= 0) {
+    close(watch.notifyDescriptor);
+  }
+}
+#else
+static void watchDirectory(const char *directoryPath) {
+  throwError("can not watch \"%s\", as watching needs inotify, available "
+             "only on Linux.",
+             directoryPath);
+}
+#endif
+
+static void *runListingWorker(void *queue) {
+  struct ListingQueue *listingQueue = queue;
+  pthread_mutex_lock(&listingQueue->mutex);
+  for (;;) {
+    /* Waits for the listing in the same slot, bounding memory. */
+    while (listingQueue->nextListing < listingQueue->totalListings &&
+           listingQueue->nextListing >=
+               listingQueue->totalWritten + listingQueue->totalInFlight) {
+      pthread_cond_wait(&listingQueue->condition, &listingQueue->mutex);
+    }
+    if (listingQueue->nextListing == listingQueue->totalListings) {
+      break;
+    }
+    int index = listingQueue->nextListing++;
+    pthread_mutex_unlock(&listingQueue->mutex);
+    struct Listing *listing = listingQueue->listings + index;
+    struct Worker *worker =
+        listingQueue->workers + index % listingQueue->totalInFlight;
+    scanDirectory(listing, worker, 0);
+    if (!listing->errorFormat) {
+      formatListing(listing, worker);
+    }
+    pthread_mutex_lock(&listingQueue->mutex);
+    listing->isScanned = 1;
+    pthread_cond_broadcast(&listingQueue->condition);
+  }
+  pthread_mutex_unlock(&listingQueue->mutex);
+  return NULL;
+}
+
+static void readDirectories(struct tmk_CmdArguments *cmdArguments,
+                            int *directoryOffsets, int totalDirectories) {
+  createAllocators();
+  struct ListingQueue listingQueue = {.mutex = PTHREAD_MUTEX_INITIALIZER,
+                                      .condition = PTHREAD_COND_INITIALIZER};
+  listingQueue.totalListings = totalDirectories;
+  listingQueue.totalInFlight =
+      totalWorkers_g > 1 ? totalWorkers_g : DEFAULT_LISTINGS_IN_FLIGHT;
+  if (listingQueue.totalInFlight > totalDirectories) {
+    listingQueue.totalInFlight = totalDirectories;
+  }
+  listingQueue.listings =
+      allocateHeapMemory(totalDirectories * sizeof(struct Listing));
+  memset(listingQueue.listings, 0, totalDirectories * sizeof(struct Listing));
+  for (int index = 0; index < totalDirectories; ++index) {
+    listingQueue.listings[index].directoryPath =
+        cmdArguments->utf8Arguments[directoryOffsets[index]];
+    listingQueue.listings[index].output.isDeferred = 1;
+  }
+  listingQueue.workers =
+      allocateHeapMemory(listingQueue.totalInFlight * sizeof(struct Worker));
+  memset(listingQueue.workers, 0,
+         listingQueue.totalInFlight * sizeof(struct Worker));
+  for (int index = 0; index < listingQueue.totalInFlight; ++index) {
+    struct Worker *worker = listingQueue.workers + index;
+    createArenaAllocator("listingEntriesAllocator", sizeof(struct Entry), 4096,
+                         &worker->entriesAllocator);
+    createArenaAllocator("listingEntriesDataAllocator", sizeof(char), 262144,
+                         &worker->entriesDataAllocator);
+  }
+  for (int index = 0; index < listingQueue.totalInFlight; ++index) {
+    if (pthread_create(&listingQueue.workers[index].thread, NULL,
+                       runListingWorker, &listingQueue)) {
+      throwError("can not create a listing thread.");
+    }
+  }
+  for (int index = 0; index < totalDirectories; ++index) {
+    struct Listing *listing = listingQueue.listings + index;
+    struct Worker *worker =
+        listingQueue.workers + index % listingQueue.totalInFlight;
+    pthread_mutex_lock(&listingQueue.mutex);
+    while (!listing->isScanned) {
+      pthread_cond_wait(&listingQueue.condition, &listingQueue.mutex);
+    }
+    pthread_mutex_unlock(&listingQueue.mutex);
+    writeListing(listing);
+    resetArenaAllocator(worker->entriesAllocator);
+    resetArenaAllocator(worker->entriesDataAllocator);
+    pthread_mutex_lock(&listingQueue.mutex);
+    ++listingQueue.totalWritten;
+    pthread_cond_broadcast(&listingQueue.condition);
+    pthread_mutex_unlock(&listingQueue.mutex);
+  }
+  for (int index = 0; index < listingQueue.totalInFlight; ++index) {
+    struct Worker *worker = listingQueue.workers + index;
+    pthread_join(worker->thread, NULL);
+    freeArenaAllocator(worker->entriesAllocator);
+    freeArenaAllocator(worker->entriesDataAllocator);
+    freeWorkerBuffers(worker);
+  }
+  free(listingQueue.workers);
+  free(listingQueue.listings);
+}
+
+static void enqueueTreeNode(int queue, struct TreeNode *node) {
+  struct TreeQueue *treeQueue = treeWalk_g.queues + queue;
+  node->queue = queue;
+  node->previousQueued = treeQueue->tail;
+  node->nextQueued = NULL;
+  if (treeQueue->tail) {
+    treeQueue->tail->nextQueued = node;
+  } else {
+    treeQueue->head = node;
+  }
+  treeQueue->tail = node;
+}
+
+static void unlinkTreeNode(struct TreeNode *node) {
+  struct TreeQueue *treeQueue = treeWalk_g.queues + node->queue;
+  if (node->previousQueued) {
+    node->previousQueued->nextQueued = node->nextQueued;
+  } else {
+    treeQueue->head = node->nextQueued;
+  }
+  if (node->nextQueued) {
+    node->nextQueued->previousQueued = node->previousQueued;
+  } else {
+    treeQueue->tail = node->previousQueued;
+  }
+}
+
+static struct TreeNode *takeTreeNode(int queue) {
+  /* Bounds the output waiting for earlier directories to be written. */
+  if (treeWalk_g.totalUnwrittenBytes >= TREE_UNWRITTEN_OUTPUT_LIMIT) {
+    return NULL;
+  }
+  /* Newest node of its own queue, depth first, or oldest of another. */
+  struct TreeNode *node = treeWalk_g.queues[queue].tail;
+  for (int offset = 1; !node && offset < treeWalk_g.totalWorkers; ++offset) {
+    node = treeWalk_g.queues[(queue + offset) % treeWalk_g.totalWorkers].head;
+  }
+  if (node) {
+    unlinkTreeNode(node);
+    node->state = TreeNodeState_Claimed;
+  }
+  return node;
+}
+
+static int isTreeNodeRepeated(const struct TreeNode *node) {
+  for (const struct TreeNode *ancestor = node->parent; ancestor;
+       ancestor = ancestor->parent) {
+    if (ancestor->device == node->device && ancestor->inode == node->inode) {
+      return 1;
+    }
+  }
+  return 0;
+}
+
+static void saveTreeNodeChildren(struct TreeNode *node) {
+  struct Listing *listing = &node->listing;
+  size_t totalChildren = 0;
+  for (size_t index = 0; index < listing->totalEntries; ++index) {
+    totalChildren += S_ISDIR(listing->entries[index].mode);
+  }
+  if (!totalChildren) {
+    return;
+  }
+  node->children = allocateHeapMemory(totalChildren * sizeof(struct TreeNode));
+  memset(node->children, 0, totalChildren * sizeof(struct TreeNode));
+  node->totalChildren = totalChildren;
+  node->totalUnopenedChildren = totalChildren;
+  /* Paths are only joined to be shown in headers. */
+  size_t pathLength = strlen(node->path);
+  size_t separatorLength = pathLength && node->path[pathLength - 1] != '/';
+  struct TreeNode *child = node->children;
+  for (size_t index = 0; index < listing->totalEntries; ++index) {
+    struct Entry *entry = listing->entries + index;
+    if (!S_ISDIR(entry->mode)) {
+      continue;
+    }
+    const char *name = listing->names + entry->nameOffset;
+    size_t nameSize = strlen(name) + 1;
+    child->path =
+        allocateHeapMemory(pathLength + separatorLength + nameSize);
+    memcpy(child->path, node->path, pathLength);
+    child->path[pathLength] = '/';
+    memcpy(child->path + pathLength + separatorLength, name, nameSize);
+    child->name = child->path + pathLength + separatorLength;
+    child->parent = node;
+    child->descriptor = -1;
+    child->depth = node->depth + 1;
+    child->listing.directoryPath = child->path;
+    child->listing.isPathResolved = 1;
+    child->listing.output.isDeferred = 1;
+    ++child;
+  }
+}
+
+static void listTreeNode(struct Worker *worker, struct TreeNode *node) {
+  struct Listing *listing = &node->listing;
+  struct TreeNode *parent = node->parent;
+  struct DirectoryScanner scanner;
+  /* Opened by its path when the parent could not keep its descriptor. */
+  int hasParentDescriptor = parent && parent->descriptor >= 0;
+  if (openListing(listing, worker,
+                  hasParentDescriptor ? parent->descriptor : AT_FDCWD,
+                  hasParentDescriptor ? node->name : listing->directoryPath,
+                  &scanner)) {
+    return;
+  }
+  struct stat directoryStat;
+  fstat(scanner.descriptor, &directoryStat);
+  node->device = directoryStat.st_dev;
+  node->inode = directoryStat.st_ino;
+  /* Mount points are listed, but the walk stays in each given filesystem. */
+  if (parent && node->device != parent->device) {
+    closeDirectoryScanner(&scanner);
+    return;
+  }
+  if (isTreeNodeRepeated(node)) {
+    listing->errorFormat = "the directory \"%s\" loops back to a parent.";
+    closeDirectoryScanner(&scanner);
+    return;
+  }
+  if (!parent) {
+    char *directoryFullPath = allocateHeapMemory(PATH_MAX);
+    if (realpath(listing->directoryPath, directoryFullPath)) {
+      node->path = directoryFullPath;
+    } else {
+      size_t pathSize = strlen(listing->directoryPath) + 1;
+      node->path = memcpy(directoryFullPath, listing->directoryPath, pathSize);
+    }
+    listing->directoryPath = node->path;
+    listing->isPathResolved = 1;
+  }
+  scanOpenedDirectory(listing, worker, &scanner, 0);
+  formatListing(listing, worker);
+  if (node->depth < maximumDepth_g) {
+    saveTreeNodeChildren(node);
+  }
+  if (node->totalChildren) {
+    node->descriptor = dup(scanner.descriptor);
+  }
+  closeDirectoryScanner(&scanner);
+  resetArenaAllocator(worker->entriesAllocator);
+  resetArenaAllocator(worker->entriesDataAllocator);
+}
+
+static void finishTreeNode(int queue, struct TreeNode *node) {
+  struct TreeNode *parent = node->parent;
+  if (parent && !--parent->totalUnopenedChildren && parent->descriptor >= 0) {
+    close(parent->descriptor);
+    --treeWalk_g.totalKeptDescriptors;
+  }
+  /* Half of the descriptors are left for the directories being listed. */
+  if (node->descriptor >= 0 && treeWalk_g.totalKeptDescriptors >=
+                                   treeWalk_g.maximumKeptDescriptors) {
+    close(node->descriptor);
+    node->descriptor = -1;
+  } else if (node->descriptor >= 0) {
+    ++treeWalk_g.totalKeptDescriptors;
+  }
+  /* Pushed backwards, so the first child is the next one taken. */
+  for (size_t index = node->totalChildren; index--;) {
+    enqueueTreeNode(queue, node->children + index);
+  }
+  node->state = TreeNodeState_Done;
+  treeWalk_g.totalUnwrittenBytes += node->listing.output.use;
+  pthread_cond_broadcast(&treeWalk_g.doneCondition);
+  if (node->totalChildren) {
+    pthread_cond_broadcast(&treeWalk_g.workCondition);
+  }
+}
+
+static void *runTreeWorker(void *worker) {
+  struct Worker *treeWorker = worker;
+  int queue = treeWorker - treeWalk_g.workers;
+  pthread_mutex_lock(&treeWalk_g.mutex);
+  for (;;) {
+    struct TreeNode *node = NULL;
+    while (!treeWalk_g.isFinished && !(node = takeTreeNode(queue))) {
+      pthread_cond_wait(&treeWalk_g.workCondition, &treeWalk_g.mutex);
+    }
+    if (!node) {
+      break;
+    }
+    pthread_mutex_unlock(&treeWalk_g.mutex);
+    listTreeNode(treeWorker, node);
+    pthread_mutex_lock(&treeWalk_g.mutex);
+    finishTreeNode(queue, node);
+  }
+  pthread_mutex_unlock(&treeWalk_g.mutex);
+  return NULL;
+}
+
+static struct TreeNode *findNextTreeNode(struct TreeNode *node) {
+  if (node->totalChildren) {
+    return node->children;
+  }
+  /* Climbing frees each subtree as soon as all of it has been written. */
+  for (;;) {
+    struct TreeNode *parent = node->parent;
+    struct TreeNode *siblingsEnd =
+        parent ? parent->children + parent->totalChildren
+               : treeWalk_g.roots + treeWalk_g.totalRoots;
+    free(node->children);
+    free(node->path);
+    if (++node < siblingsEnd) {
+      return node;
+    }
+    if (!parent) {
+      return NULL;
+    }
+    node = parent;
+  }
+}
+
+static void walkTrees(struct tmk_CmdArguments *cmdArguments,
+                      int *directoryOffsets, int totalDirectories) {
+  createAllocators();
+  /* The walk measuring directories gets its share of the descriptors. */
+  treeWalk_g.maximumKeptDescriptors =
+      raiseDescriptorsLimit() / (isMeasuringDirectories_g ? 2 : 1);
+  treeWalk_g.totalRoots = totalDirectories ? totalDirectories : 1;
+  treeWalk_g.roots =
+      allocateHeapMemory(treeWalk_g.totalRoots * sizeof(struct TreeNode));
+  memset(treeWalk_g.roots, 0, treeWalk_g.totalRoots * sizeof(struct TreeNode));
+  treeWalk_g.totalWorkers =
+      1 + (totalWorkers_g > 1 ? totalWorkers_g : DEFAULT_LISTINGS_IN_FLIGHT);
+  treeWalk_g.queues =
+      allocateHeapMemory(treeWalk_g.totalWorkers * sizeof(struct TreeQueue));
+  memset(treeWalk_g.queues, 0,
+         treeWalk_g.totalWorkers * sizeof(struct TreeQueue));
+  treeWalk_g.workers =
+      allocateHeapMemory(treeWalk_g.totalWorkers * sizeof(struct Worker));
+  memset(treeWalk_g.workers, 0,
+         treeWalk_g.totalWorkers * sizeof(struct Worker));
+  for (int index = treeWalk_g.totalRoots; index--;) {
+    struct TreeNode *root = treeWalk_g.roots + index;
+    root->descriptor = -1;
+    root->listing.directoryPath =
+        totalDirectories ? cmdArguments->utf8Arguments[directoryOffsets[index]]
+                         : ".";
+    root->listing.output.isDeferred = 1;
+    enqueueTreeNode(0, root);
+  }
+  for (int index = 0; index < treeWalk_g.totalWorkers; ++index) {
+    struct Worker *worker = treeWalk_g.workers + index;
+    createArenaAllocator("treeEntriesAllocator", sizeof(struct Entry), 4096,
+                         &worker->entriesAllocator);
+    createArenaAllocator("treeEntriesDataAllocator", sizeof(char), 262144,
+                         &worker->entriesDataAllocator);
+  }
+  for (int index = 1; index < treeWalk_g.totalWorkers; ++index) {
+    if (pthread_create(&treeWalk_g.workers[index].thread, NULL, runTreeWorker,
+                       treeWalk_g.workers + index)) {
+      throwError("can not create a tree thread.");
+    }
+  }
+  for (struct TreeNode *node = treeWalk_g.roots; node;
+       node = findNextTreeNode(node)) {
+    pthread_mutex_lock(&treeWalk_g.mutex);
+    while (node->state != TreeNodeState_Done) {
+      if (node->state == TreeNodeState_Queued) {
+        unlinkTreeNode(node);
+        node->state = TreeNodeState_Claimed;
+        pthread_mutex_unlock(&treeWalk_g.mutex);
+        listTreeNode(treeWalk_g.workers, node);
+        pthread_mutex_lock(&treeWalk_g.mutex);
+        finishTreeNode(0, node);
+      } else {
+        pthread_cond_wait(&treeWalk_g.doneCondition, &treeWalk_g.mutex);
+      }
+    }
+    int wasThrottled =
+        treeWalk_g.totalUnwrittenBytes >= TREE_UNWRITTEN_OUTPUT_LIMIT;
+    treeWalk_g.totalUnwrittenBytes -= node->listing.output.use;
+    if (wasThrottled &&
+        treeWalk_g.totalUnwrittenBytes < TREE_UNWRITTEN_OUTPUT_LIMIT) {
+      pthread_cond_broadcast(&treeWalk_g.workCondition);
+    }
+    pthread_mutex_unlock(&treeWalk_g.mutex);
+    writeListing(&node->listing);
+  }
+  pthread_mutex_lock(&treeWalk_g.mutex);
+  treeWalk_g.isFinished = 1;
+  pthread_cond_broadcast(&treeWalk_g.workCondition);
+  pthread_mutex_unlock(&treeWalk_g.mutex);
+  for (int index = 0; index < treeWalk_g.totalWorkers; ++index) {
+    struct Worker *worker = treeWalk_g.workers + index;
+    if (index) {
+      pthread_join(worker->thread, NULL);
+    }
+    freeArenaAllocator(worker->entriesAllocator);
+    freeArenaAllocator(worker->entriesDataAllocator);
+    freeWorkerBuffers(worker);
+  }
+  free(treeWalk_g.workers);
+  free(treeWalk_g.queues);
+  free(treeWalk_g.roots);
+}
+
+static size_t raiseDescriptorsLimit(void) {
+  /* Waiting directories keep up to half of the descriptors. */
+  struct rlimit descriptorsLimit;
+  if (getrlimit(RLIMIT_NOFILE, &descriptorsLimit)) {
+    return 0;
+  }
+  rlim_t currentLimit = descriptorsLimit.rlim_cur;
+  descriptorsLimit.rlim_cur = descriptorsLimit.rlim_max;
+  if (setrlimit(RLIMIT_NOFILE, &descriptorsLimit)) {
+    descriptorsLimit.rlim_cur = currentLimit;
+  }
+  return descriptorsLimit.rlim_cur == RLIM_INFINITY
+             ? SIZE_MAX / 2
+             : descriptorsLimit.rlim_cur / 2;
+}
+
+static void createSizeWalk(void) {
+  if (sizeWalk_g.workers) {
+    return;
+  }
+  long totalProcessors = sysconf(_SC_NPROCESSORS_ONLN);
+  sizeWalk_g.totalWorkers = totalWorkers_g > 1    ? totalWorkers_g
+                            : totalProcessors < 1 ? 1
+                            : totalProcessors > MAXIMUM_TOTAL_WORKERS
+                                ? MAXIMUM_TOTAL_WORKERS
+                                : totalProcessors;
+  sizeWalk_g.maximumKeptDescriptors =
+      raiseDescriptorsLimit() / (maximumDepth_g ? 2 : 1);
+  /* The first queue is shared by the threads measuring their listings. */
+  sizeWalk_g.queues = allocateHeapMemory((sizeWalk_g.totalWorkers + 1) *
+                                         sizeof(struct SizeQueue));
+  memset(sizeWalk_g.queues, 0,
+         (sizeWalk_g.totalWorkers + 1) * sizeof(struct SizeQueue));
+  sizeWalk_g.workers =
+      allocateHeapMemory(sizeWalk_g.totalWorkers * sizeof(struct Worker));
+  memset(sizeWalk_g.workers, 0,
+         sizeWalk_g.totalWorkers * sizeof(struct Worker));
+  for (int index = 0; index < sizeWalk_g.totalWorkers; ++index) {
+    if (pthread_create(&sizeWalk_g.workers[index].thread, NULL, runSizeWorker,
+                       sizeWalk_g.workers + index)) {
+      throwError("can not create a size thread.");
+    }
+  }
+}
+
+static void enqueueSizeTask(int queue, struct SizeTask *task) {
+  struct SizeQueue *sizeQueue = sizeWalk_g.queues + queue;
+  task->queue = queue;
+  task->previousQueued = sizeQueue->tail;
+  task->nextQueued = NULL;
+  if (sizeQueue->tail) {
+    sizeQueue->tail->nextQueued = task;
+  } else {
+    sizeQueue->head = task;
+  }
+  sizeQueue->tail = task;
+}
+
+static struct SizeTask *takeSizeTask(int queue) {
+  /* Same as with trees: the newest task of its own queue or the oldest one. */
+  struct SizeTask *task = sizeWalk_g.queues[queue].tail;
+  for (int offset = 1; !task && offset <= sizeWalk_g.totalWorkers; ++offset) {
+    task = sizeWalk_g.queues[(queue + offset) % (sizeWalk_g.totalWorkers + 1)]
+               .head;
+  }
+  if (!task) {
+    return NULL;
+  }
+  struct SizeQueue *sizeQueue = sizeWalk_g.queues + task->queue;
+  if (task->previousQueued) {
+    task->previousQueued->nextQueued = task->nextQueued;
+  } else {
+    sizeQueue->head = task->nextQueued;
+  }
+  if (task->nextQueued) {
+    task->nextQueued->previousQueued = task->previousQueued;
+  } else {
+    sizeQueue->tail = task->previousQueued;
+  }
+  return task;
+}
+
+static struct SizeTask *createSizeTask(struct SizeTask *parent,
+                                       struct SizeMeasure *measure,
+                                       struct DirectorySize *size,
+                                       const char *name) {
+  size_t nameSize = strlen(name) + 1;
+  struct SizeTask *task =
+      allocateHeapMemory(sizeof(struct SizeTask) + nameSize);
+  memcpy(task->name, name, nameSize);
+  task->parent = parent;
+  task->measure = measure;
+  task->size = size;
+  task->totalReferences = 1;
+  task->totalUnopenedChildren = 0;
+  task->device = parent ? parent->device : 0;
+  task->descriptor = -1;
+  return task;
+}
+
+static void releaseSizeTask(struct SizeTask *task) {
+  /* Tasks are kept while any task inside them is, to find their paths. */
+  while (task && !--task->totalReferences) {
+    struct SizeTask *parent = task->parent;
+    free(task);
+    task = parent;
+  }
+}
+
+static int claimInode(struct SizeMeasure *measure,
+                      const struct DirectorySize *size, dev_t device,
+                      ino_t inode) {
+  /* Hard links are counted once in each measured directory, as du does. */
+  if ((measure->totalInodes + 1) * 4 > measure->inodesCapacity * 3) {
+    size_t capacity = measure->inodesCapacity
+                          ? measure->inodesCapacity * 2
+                          : INODE_SET_INITIAL_CAPACITY;
+    struct InodeKey *inodes =
+        allocateHeapMemory(capacity * sizeof(struct InodeKey));
+    memset(inodes, 0, capacity * sizeof(struct InodeKey));
+    for (size_t index = 0; index < measure->inodesCapacity; ++index) {
+      struct InodeKey *key = measure->inodes + index;
+      if (!key->size) {
+        continue;
+      }
+      size_t slot = (key->inode * 0x9e3779b97f4a7c15ULL ^ key->device) &
+                    (capacity - 1);
+      while (inodes[slot].size) {
+        slot = (slot + 1) & (capacity - 1);
+      }
+      inodes[slot] = *key;
     }
-    PARSE_MODE(S_IRUSR, 'r', tmk_AnsiColor_DarkRed);
-    PARSE_MODE(S_IWUSR, 'w', tmk_AnsiColor_DarkGreen);
-    PARSE_MODE(S_IXUSR, 'x', tmk_AnsiColor_DarkYellow);
-    PARSE_MODE(S_IRGRP, 'r', tmk_AnsiColor_DarkRed);
-    PARSE_MODE(S_IWGRP, 'w', tmk_AnsiColor_DarkGreen);
-    PARSE_MODE(S_IXGRP, 'x', tmk_AnsiColor_DarkYellow);
-    PARSE_MODE(S_IROTH, 'r', tmk_AnsiColor_DarkRed);
-    PARSE_MODE(S_IWOTH, 'w', tmk_AnsiColor_DarkGreen);
-    PARSE_MODE(S_IXOTH, 'x', tmk_AnsiColor_DarkYellow);
-    tmk_setFontAnsiColor(tmk_AnsiColor_DarkMagenta, tmk_Layer_Foreground);
-    tmk_write(" %-3o ",
-              entry.mode & (S_IRUSR | S_IWUSR | S_IXUSR | S_IRGRP | S_IWGRP |
-                            S_IXGRP | S_IROTH | S_IWOTH | S_IXOTH));
-    if (S_ISREG(entry.mode)) {
-      tmk_resetFontColors();
-    } else {
-      tmk_setFontAnsiColor(S_ISDIR(entry.mode)    ? tmk_AnsiColor_DarkYellow
-                           : S_ISLNK(entry.mode)  ? tmk_AnsiColor_DarkBlue
-                           : S_ISBLK(entry.mode)  ? tmk_AnsiColor_DarkMagenta
-                           : S_ISCHR(entry.mode)  ? tmk_AnsiColor_DarkGreen
-                           : S_ISFIFO(entry.mode) ? tmk_AnsiColor_DarkBlue
-                                                  : tmk_AnsiColor_DarkCyan,
-                           tmk_Layer_Foreground);
+    free(measure->inodes);
+    measure->inodes = inodes;
+    measure->inodesCapacity = capacity;
+  }
+  size_t slot =
+      (inode * 0x9e3779b97f4a7c15ULL ^ device) & (measure->inodesCapacity - 1);
+  for (struct InodeKey *key; (key = measure->inodes + slot)->size;
+       slot = (slot + 1) & (measure->inodesCapacity - 1)) {
+    if (key->size == size && key->device == device && key->inode == inode) {
+      return 0;
     }
-    if (tmk_isStreamRedirected(tmk_Stream_Output)) {
-      tmk_write(S_ISDIR(entry.mode)    ? "d "
-                : S_ISLNK(entry.mode)  ? "l "
-                : S_ISBLK(entry.mode)  ? "b "
-                : S_ISCHR(entry.mode)  ? "c "
-                : S_ISFIFO(entry.mode) ? "f "
-                : S_ISREG(entry.mode)  ? "- "
-                                       : "s ");
-    } else {
-      tmk_write(S_ISDIR(entry.mode)    ? " "
-                : S_ISLNK(entry.mode)  ? "󰌷 "
-                : S_ISBLK(entry.mode)  ? "󰇖 "
-                : S_ISCHR(entry.mode)  ? "󱣴 "
-                : S_ISFIFO(entry.mode) ? "󰟦 "
-                : S_ISREG(entry.mode)  ? " "
-                                       : "󱄙 ");
+  }
+  measure->inodes[slot] =
+      (struct InodeKey){.size = size, .device = device, .inode = inode};
+  ++measure->totalInodes;
+  return 1;
+}
+
+static int openSizeTask(struct Worker *worker, struct SizeTask *task,
+                        struct DirectoryScanner *scanner) {
+  struct SizeTask *parent = task->parent;
+  if (!parent || parent->descriptor >= 0) {
+    return openDirectoryScanner(
+        parent ? parent->descriptor : task->measure->directoryDescriptor,
+        task->name, worker->directoryBuffer, scanner);
+  }
+  /* Without its parent, opened from the directory listed. */
+  size_t pathSize = 0;
+  for (struct SizeTask *ancestor = task; ancestor;
+       ancestor = ancestor->parent) {
+    pathSize += strlen(ancestor->name) + 1;
+  }
+  char *path = allocateHeapMemory(pathSize);
+  char *end = path + pathSize - 1;
+  *end = 0;
+  for (struct SizeTask *ancestor = task; ancestor;
+       ancestor = ancestor->parent) {
+    size_t nameLength = strlen(ancestor->name);
+    end -= nameLength;
+    memcpy(end, ancestor->name, nameLength);
+    if (end > path) {
+      *--end = '/';
     }
-    tmk_resetFontColors();
-    tmk_write("%s", entry.name);
-    if (entry.link) {
-      tmk_setFontAnsiColor(tmk_AnsiColor_LightBlack, tmk_Layer_Foreground);
-      tmk_write(" -> ");
-      tmk_resetFontColors();
-      tmk_writeLine(entry.link);
-    } else {
-      tmk_writeLine("");
+  }
+  int result = openDirectoryScanner(task->measure->directoryDescriptor, path,
+                                    worker->directoryBuffer, scanner);
+  free(path);
+  return result;
+}
+
+static void measureSizeTask(struct Worker *worker, int queue,
+                            struct SizeTask *task) {
+  struct SizeMeasure *measure = task->measure;
+  struct SizeTask *parent = task->parent;
+  struct DirectoryScanner scanner;
+  createWorkerBuffers(worker);
+  int isOpened = !openSizeTask(worker, task, &scanner);
+  struct DirectorySize size = {0};
+  struct SizeTask *children = NULL;
+  size_t totalChildren = 0;
+  if (isOpened && !parent) {
+    struct stat directoryStat;
+    fstat(scanner.descriptor, &directoryStat);
+    task->device = directoryStat.st_dev;
+    size.apparentSize = directoryStat.st_size;
+    size.allocatedSize = (unsigned long long)directoryStat.st_blocks * 512;
+  }
+  for (size_t totalRecords;
+       isOpened &&
+       (totalRecords =
+            scanDirectoryBatch(worker, &scanner, DIRECTORY_BATCH_CAPACITY));) {
+    statDirectoryRecords(worker, scanner.descriptor, worker->records,
+                         totalRecords);
+    for (size_t index = 0; index < totalRecords; ++index) {
+      struct DirectoryRecord *record = worker->records + index;
+      if (!record->isStated) {
+        continue;
+      }
+      /* Like the listing of trees, the measure stays in one filesystem. */
+      if (S_ISDIR(record->mode) && record->device != task->device) {
+        continue;
+      }
+      if (!S_ISDIR(record->mode) && record->totalLinks > 1) {
+        pthread_mutex_lock(&sizeWalk_g.mutex);
+        int isClaimed =
+            claimInode(measure, task->size, record->device, record->inode);
+        pthread_mutex_unlock(&sizeWalk_g.mutex);
+        if (!isClaimed) {
+          continue;
+        }
+      }
+      size.apparentSize += record->size;
+      size.allocatedSize += record->allocatedSize;
+      if (S_ISDIR(record->mode)) {
+        struct SizeTask *child =
+            createSizeTask(task, measure, task->size, record->name);
+        child->nextQueued = children;
+        children = child;
+        ++totalChildren;
+      }
     }
   }
-  resetArenaAllocator(entriesAllocator_g);
-  resetArenaAllocator(entriesDataAllocator_g);
+  if (totalChildren) {
+    task->descriptor = dup(scanner.descriptor);
+  }
+  if (isOpened) {
+    closeDirectoryScanner(&scanner);
+  }
+  pthread_mutex_lock(&sizeWalk_g.mutex);
+  if (parent && !--parent->totalUnopenedChildren && parent->descriptor >= 0) {
+    close(parent->descriptor);
+    parent->descriptor = -1;
+    --sizeWalk_g.totalKeptDescriptors;
+  }
+  if (task->descriptor >= 0 && sizeWalk_g.totalKeptDescriptors >=
+                                   sizeWalk_g.maximumKeptDescriptors) {
+    close(task->descriptor);
+    task->descriptor = -1;
+  } else if (task->descriptor >= 0) {
+    ++sizeWalk_g.totalKeptDescriptors;
+  }
+  task->size->apparentSize += size.apparentSize;
+  task->size->allocatedSize += size.allocatedSize;
+  task->totalUnopenedChildren = totalChildren;
+  task->totalReferences += totalChildren;
+  for (struct SizeTask *child = children, *next; child; child = next) {
+    next = child->nextQueued;
+    enqueueSizeTask(queue, child);
+  }
+  measure->totalPendingTasks += totalChildren;
+  if (totalChildren) {
+    pthread_cond_broadcast(&sizeWalk_g.workCondition);
+  }
+  releaseSizeTask(task);
+  if (!--measure->totalPendingTasks) {
+    pthread_cond_broadcast(&sizeWalk_g.doneCondition);
+  }
+  pthread_mutex_unlock(&sizeWalk_g.mutex);
+}
+
+static void *runSizeWorker(void *worker) {
+  struct Worker *sizeWorker = worker;
+  int queue = sizeWorker - sizeWalk_g.workers + 1;
+  pthread_mutex_lock(&sizeWalk_g.mutex);
+  for (;;) {
+    struct SizeTask *task = NULL;
+    while (!sizeWalk_g.isExiting && !(task = takeSizeTask(queue))) {
+      pthread_cond_wait(&sizeWalk_g.workCondition, &sizeWalk_g.mutex);
+    }
+    if (!task) {
+      break;
+    }
+    pthread_mutex_unlock(&sizeWalk_g.mutex);
+    measureSizeTask(sizeWorker, queue, task);
+    pthread_mutex_lock(&sizeWalk_g.mutex);
+  }
+  pthread_mutex_unlock(&sizeWalk_g.mutex);
+  return NULL;
+}
+
+static int measureDirectories(struct Worker *worker, int directoryDescriptor,
+                              struct Entry *entries, size_t totalEntries,
+                              const char *names) {
+  /* Joins the size walk until the directories of the listing are done. */
+  size_t totalDirectories = 0;
+  for (size_t index = 0; index < totalEntries; ++index) {
+    totalDirectories += S_ISDIR(entries[index].mode);
+  }
+  if (!totalDirectories) {
+    return 0;
+  }
+  struct SizeMeasure measure = {.directoryDescriptor = directoryDescriptor};
+  measure.sizes =
+      allocateHeapMemory(totalDirectories * sizeof(struct DirectorySize));
+  memset(measure.sizes, 0, totalDirectories * sizeof(struct DirectorySize));
+  pthread_mutex_lock(&sizeWalk_g.mutex);
+  for (size_t index = 0, offset = 0; index < totalEntries; ++index) {
+    if (S_ISDIR(entries[index].mode)) {
+      struct SizeTask *task = createSizeTask(
+          NULL, &measure, measure.sizes + offset++,
+          names + entries[index].nameOffset);
+      enqueueSizeTask(0, task);
+    }
+  }
+  measure.totalPendingTasks = totalDirectories;
+  pthread_cond_broadcast(&sizeWalk_g.workCondition);
+  while (measure.totalPendingTasks) {
+    struct SizeTask *task = worker ? takeSizeTask(0) : NULL;
+    if (!task) {
+      pthread_cond_wait(&sizeWalk_g.doneCondition, &sizeWalk_g.mutex);
+      continue;
+    }
+    pthread_mutex_unlock(&sizeWalk_g.mutex);
+    measureSizeTask(worker, 0, task);
+    pthread_mutex_lock(&sizeWalk_g.mutex);
+  }
+  pthread_mutex_unlock(&sizeWalk_g.mutex);
+  int sizeColumnLength = 0;
+  for (size_t index = 0, offset = 0; index < totalEntries; ++index) {
+    struct Entry *entry = entries + index;
+    if (!S_ISDIR(entry->mode)) {
+      continue;
+    }
+    struct DirectorySize *size = measure.sizes + offset++;
+    entry->size = isSizeAllocated_g ? size->allocatedSize : size->apparentSize;
+    entry->hasSize = 1;
+    char sizeBuffer[SIZE_BUFFER_SIZE];
+    int sizeLength = formatSize(sizeBuffer, entry->size);
+    SAVE_GREATER(sizeColumnLength, sizeLength);
+  }
+  free(measure.sizes);
+  free(measure.inodes);
+  return sizeColumnLength;
+}
+
+static void freeSizeWalk(void) {
+  if (!sizeWalk_g.workers) {
+    return;
+  }
+  pthread_mutex_lock(&sizeWalk_g.mutex);
+  sizeWalk_g.isExiting = 1;
+  pthread_cond_broadcast(&sizeWalk_g.workCondition);
+  pthread_mutex_unlock(&sizeWalk_g.mutex);
+  for (int index = 0; index < sizeWalk_g.totalWorkers; ++index) {
+    pthread_join(sizeWalk_g.workers[index].thread, NULL);
+    freeWorkerBuffers(sizeWalk_g.workers + index);
+  }
+  free(sizeWalk_g.workers);
+  free(sizeWalk_g.queues);
+}
+
+static uint64_t readStatsClock(clockid_t clock) {
+  struct timespec time;
+  clock_gettime(clock, &time);
+  return (uint64_t)time.tv_sec * 1000000000 + time.tv_nsec;
+}
+
+static void startStatsClock(struct StatsClock *clock) {
+  if (!statsFormat_g) {
+    return;
+  }
+  clock->wallTime = readStatsClock(CLOCK_MONOTONIC);
+  clock->cpuTime = readStatsClock(CLOCK_THREAD_CPUTIME_ID);
+}
+
+static void stopStatsClock(struct Worker *worker, enum StatsPhase phase,
+                           const struct StatsClock *clock, size_t totalCalls) {
+  savePhaseStats(worker->stats.phases + phase, clock, totalCalls);
+}
+
+static void savePhaseStats(struct PhaseStats *stats,
+                           const struct StatsClock *clock, size_t totalCalls) {
+  if (!statsFormat_g) {
+    return;
+  }
+  stats->wallTime += readStatsClock(CLOCK_MONOTONIC) - clock->wallTime;
+  stats->cpuTime += readStatsClock(CLOCK_THREAD_CPUTIME_ID) - clock->cpuTime;
+  stats->totalCalls += totalCalls;
+}
+
+static void saveWorkerStats(const struct Worker *worker) {
+  /* Workers are only freed by the main thread, after they have finished. */
+  for (int phase = 0; phase < TOTAL_STATS_PHASES; ++phase) {
+    struct PhaseStats *stats = stats_g.workers.phases + phase;
+    stats->wallTime += worker->stats.phases[phase].wallTime;
+    stats->cpuTime += worker->stats.phases[phase].cpuTime;
+    stats->totalCalls += worker->stats.phases[phase].totalCalls;
+  }
+  stats_g.workers.totalCredentialHits += worker->stats.totalCredentialHits;
+  stats_g.workers.totalCredentialLookups +=
+      worker->stats.totalCredentialLookups;
+}
+
+static void saveArenaStats(const struct ArenaAllocator *allocator) {
+  /* Allocators of each worker are reported by their greatest peaks. */
+  if (!statsFormat_g) {
+    return;
+  }
+  struct ArenaStats *stats = stats_g.arenas;
+  while (stats < stats_g.arenas + stats_g.totalArenas &&
+         strcmp(stats->name, allocator->name)) {
+    ++stats;
+  }
+  if (stats == stats_g.arenas + ARENA_STATS_CAPACITY) {
+    return;
+  }
+  if (stats == stats_g.arenas + stats_g.totalArenas) {
+    size_t nameSize = strlen(allocator->name) + 1;
+    stats->name = memcpy(allocateHeapMemory(nameSize), allocator->name,
+                         nameSize);
+    stats->unit = allocator->unit;
+    ++stats_g.totalArenas;
+  }
+  ++stats->totalAllocators;
+  SAVE_GREATER(stats->peakUse, allocator->peakUse);
+  SAVE_GREATER(stats->peakUse, allocator->use);
+  SAVE_GREATER(stats->peakCapacity, allocator->peakCapacity);
+}
+
+static void writeTextStats(void) {
+  tmk_writeError("%-12s %12s %12s %12s\n", "Phase", "Wall (ms)", "CPU (ms)",
+                 "Syscalls");
+  for (int phase = 0; phase < TOTAL_STATS_PHASES; ++phase) {
+    const struct PhaseStats *stats = stats_g.workers.phases + phase;
+    tmk_writeError("%-12s %12.3f %12.3f %12zu\n", statsPhaseNames_g[phase],
+                   stats->wallTime / 1e6, stats->cpuTime / 1e6,
+                   stats->totalCalls);
+  }
+  tmk_writeError("%-12s %12.3f %12.3f\n", "process",
+                 (readStatsClock(CLOCK_MONOTONIC) - stats_g.startTime) / 1e6,
+                 readStatsClock(CLOCK_PROCESS_CPUTIME_ID) / 1e6);
+  size_t totalWorkerHits = stats_g.workers.totalCredentialHits;
+  size_t totalRequests =
+      totalWorkerHits + stats_g.workers.totalCredentialLookups;
+  tmk_writeError("\nCredentials: %zu requests, %.2f%% hits (%zu by workers, "
+                 "%zu by tables),\n%zu system lookups, %zu databases "
+                 "preloaded.\n",
+                 totalRequests,
+                 totalRequests ? (totalWorkerHits +
+                                  stats_g.totalTableCredentialHits) *
+                                     100.0 / totalRequests
+                               : 0.0,
+                 totalWorkerHits, stats_g.totalTableCredentialHits,
+                 stats_g.totalSystemCredentialLookups,
+                 stats_g.totalPreloadedDatabases);
+  tmk_writeError("\n%-32s %6s %10s %14s %14s\n", "Arena", "Unit",
+                 "Allocators", "Peak Use (B)", "Peak Size (B)");
+  for (size_t index = 0; index < stats_g.totalArenas; ++index) {
+    const struct ArenaStats *stats = stats_g.arenas + index;
+    tmk_writeError("%-32s %6zu %10zu %14zu %14zu\n", stats->name, stats->unit,
+                   stats->totalAllocators, stats->peakUse * stats->unit,
+                   stats->peakCapacity * stats->unit);
+  }
+}
+
+static void writeJSONStats(void) {
+  tmk_writeError("{\"phases\":{");
+  for (int phase = 0; phase < TOTAL_STATS_PHASES; ++phase) {
+    const struct PhaseStats *stats = stats_g.workers.phases + phase;
+    tmk_writeError("%s\"%s\":{\"wall\":%.9f,\"cpu\":%.9f,\"syscalls\":%zu}",
+                   phase ? "," : "", statsPhaseNames_g[phase],
+                   stats->wallTime / 1e9, stats->cpuTime / 1e9,
+                   stats->totalCalls);
+  }
+  tmk_writeError("},\"process\":{\"wall\":%.9f,\"cpu\":%.9f}",
+                 (readStatsClock(CLOCK_MONOTONIC) - stats_g.startTime) / 1e9,
+                 readStatsClock(CLOCK_PROCESS_CPUTIME_ID) / 1e9);
+  tmk_writeError(",\"credentials\":{\"requests\":%zu,\"workerHits\":%zu,"
+                 "\"tableHits\":%zu,\"systemLookups\":%zu,"
+                 "\"preloadedDatabases\":%zu}",
+                 stats_g.workers.totalCredentialHits +
+                     stats_g.workers.totalCredentialLookups,
+                 stats_g.workers.totalCredentialHits,
+                 stats_g.totalTableCredentialHits,
+                 stats_g.totalSystemCredentialLookups,
+                 stats_g.totalPreloadedDatabases);
+  tmk_writeError(",\"arenas\":{");
+  for (size_t index = 0; index < stats_g.totalArenas; ++index) {
+    const struct ArenaStats *stats = stats_g.arenas + index;
+    tmk_writeError("%s\"%s\":{\"unit\":%zu,\"allocators\":%zu,"
+                   "\"peakUse\":%zu,\"peakSize\":%zu}",
+                   index ? "," : "", stats->name, stats->unit,
+                   stats->totalAllocators, stats->peakUse * stats->unit,
+                   stats->peakCapacity * stats->unit);
+  }
+  tmk_writeError("}}\n");
+}
+
+static void writeStats(void) {
+  /* Times of phases are summed over all threads. */
+  if (statsFormat_g == StatsFormat_Text) {
+    writeTextStats();
+  } else {
+    writeJSONStats();
+  }
+  for (size_t index = 0; index < stats_g.totalArenas; ++index) {
+    free(stats_g.arenas[index].name);
+  }
+}
+
+static void reserveOutput(struct OutputBuffer *output, size_t size) {
+  if (output->use + size <= output->capacity) {
+    return;
+  }
+  /* Deferred listings grow until they can be written in order. */
+  if (!output->isDeferred && output->use) {
+    flushOutput(output);
+    if (size <= output->capacity) {
+      return;
+    }
+  }
+  size_t capacity = output->capacity ? output->capacity : OUTPUT_BUFFER_SIZE;
+  while (output->use + size > capacity) {
+    capacity *= 2;
+  }
+  char *buffer = realloc(output->buffer, capacity);
+  if (!buffer) {
+    throwError("can not allocate %zuB of memory on the heap.", capacity);
+  }
+  output->buffer = buffer;
+  output->capacity = capacity;
+}
+
+static void appendOutput(struct OutputBuffer *output, const char *buffer,
+                         size_t size) {
+  reserveOutput(output, size);
+  memcpy(output->buffer + output->use, buffer, size);
+  output->use += size;
+}
+
+static void appendOutputString(struct OutputBuffer *output,
+                               const char *string) {
+  appendOutput(output, string, strlen(string));
+}
+
+static void appendOutputEscape(struct OutputBuffer *output,
+                               const char *escape) {
+  if (isOutputColored_g) {
+    appendOutputString(output, escape);
+  }
+}
+
+static void appendOutputCharacters(struct OutputBuffer *output, char character,
+                                   int total) {
+  if (total <= 0) {
+    return;
+  }
+  reserveOutput(output, total);
+  memset(output->buffer + output->use, character, total);
+  output->use += total;
+}
+
+static void appendOutputPadded(struct OutputBuffer *output, const char *string,
+                               int width, int isRightAligned) {
+  int length = strlen(string);
+  if (isRightAligned) {
+    appendOutputCharacters(output, ' ', width - length);
+  }
+  appendOutput(output, string, length);
+  if (!isRightAligned) {
+    appendOutputCharacters(output, ' ', width - length);
+  }
+}
+
+static size_t appendOutputNumber(struct OutputBuffer *output,
+                                 unsigned long long number, int base,
+                                 int width, char padding) {
+  char digits[24];
+  int length = 0;
+  do {
+    digits[sizeof(digits) - ++length] = '0' + number % base;
+    number /= base;
+  } while (number);
+  appendOutputCharacters(output, padding, width - length);
+  appendOutput(output, digits + sizeof(digits) - length, length);
+  return length;
+}
+
+static void flushOutput(struct OutputBuffer *output) {
+  /* Listings are only written by the main thread, the first one with it. */
+  struct StatsClock clock;
+  startStatsClock(&clock);
+  size_t totalCalls = 0;
+  if (recordsHeader_g) {
+    totalCalls += writeOutput(recordsHeader_g, strlen(recordsHeader_g));
+    recordsHeader_g = NULL;
+  }
+  totalCalls += writeOutput(output->buffer, output->use);
+  output->use = 0;
+  savePhaseStats(stats_g.workers.phases + StatsPhase_Write, &clock,
+                 totalCalls);
+}
+
+static size_t writeOutput(const char *buffer, size_t size) {
+  size_t totalCalls = 0;
+  while (size) {
+    ssize_t length = write(STDOUT_FILENO, buffer, size);
+    ++totalCalls;
+    if (length < 0 && errno == EINTR) {
+      continue;
+    }
+    if (length <= 0) {
+      break;
+    }
+    buffer += length;
+    size -= length;
+  }
+  return totalCalls;
 }
 #endif
 
+#if tmk_IS_OPERATING_SYSTEM_WINDOWS
 static void writeLines(size_t totalLines, ...) {
   va_list arguments;
   va_start(arguments, totalLines);
@@ -651,8 +5125,8 @@ static void writeLines(size_t totalLines, ...) {
   tmk_writeLine("");
 }
 
-static char *formatModifiedDate(int month, int day, int year,
-                                size_t *bufferSize) {
+static char *formatModifiedDate(struct ArenaAllocator *allocator, int month,
+                                int day, int year, size_t *bufferSize) {
   char formatBuffer[12];
   sprintf(formatBuffer, "%s/%02d/%04d",
           !month        ? "Jan"
@@ -669,7 +5143,7 @@ static char *formatModifiedDate(int month, int day, int year,
                         : "Dec",
           day, year);
   *bufferSize = strlen(formatBuffer) + 1;
-  char *buffer = allocateArenaMemory(temporaryDataAllocator_g, *bufferSize);
+  char *buffer = allocateArenaMemory(allocator, *bufferSize);
   memcpy(buffer, formatBuffer, *bufferSize);
   return buffer;
 }
@@ -678,29 +5152,47 @@ static int sortEntriesAlphabetically(const void *entryI, const void *entryII) {
   return strcmp(((struct Entry *)entryI)->name,
                 ((struct Entry *)entryII)->name);
 }
+#endif
 
-static char *formatSize(size_t *bufferLength, unsigned long long entrySize,
-                        int isDirectory) {
-  if (isDirectory) {
-    *bufferLength = 0;
-    return NULL;
+static int formatSize(char *buffer, unsigned long long entrySize) {
+  /* Integers only, rounding tenths to even as printf does. */
+  static const char prefixes[] = "kMGTPE";
+  unsigned long long multiplier = 1;
+  int prefixIndex = -1;
+  while (!isSizeExact_g && prefixIndex < 5 &&
+         entrySize / multiplier >= sizeBase_g) {
+    multiplier *= sizeBase_g;
+    ++prefixIndex;
   }
-  char formatBuffer[9];
-  struct SIMultiplier multipliers[] = {
-      {1099511627776, 'T'}, {1073741824, 'G'}, {1048576, 'M'}, {1024, 'k'}};
-  for (size_t index = 0; index < 4; ++index) {
-    if (entrySize >= multipliers[index].value) {
-      float formatedSize = entrySize / multipliers[index].value;
-      sprintf(formatBuffer, "%.1f%cB", formatedSize, multipliers[index].prefix);
-      goto end_l;
-    }
-  }
-  sprintf(formatBuffer, "%lldB", entrySize);
-end_l:
-  *bufferLength = strlen(formatBuffer);
-  char *buffer = allocateArenaMemory(entriesDataAllocator_g, *bufferLength + 1);
-  memcpy(buffer, formatBuffer, *bufferLength + 1);
-  return buffer;
+  unsigned long long whole = entrySize / multiplier;
+  unsigned long long remainder = entrySize % multiplier * 10;
+  unsigned long long tenths = remainder / multiplier;
+  remainder = remainder % multiplier * 2;
+  if (remainder > multiplier || (remainder == multiplier && tenths & 1)) {
+    ++tenths;
+  }
+  if (tenths == 10) {
+    ++whole;
+    tenths = 0;
+  }
+  char digits[SIZE_BUFFER_SIZE];
+  int totalDigits = 0;
+  do {
+    digits[totalDigits++] = '0' + whole % 10;
+    whole /= 10;
+  } while (whole);
+  int length = 0;
+  while (totalDigits) {
+    buffer[length++] = digits[--totalDigits];
+  }
+  if (prefixIndex >= 0) {
+    buffer[length++] = '.';
+    buffer[length++] = '0' + tenths;
+    buffer[length++] = prefixes[prefixIndex];
+  }
+  buffer[length++] = 'B';
+  buffer[length] = 0;
+  return length;
 }
 
 static int countDigits(size_t number) {
@@ -741,6 +5233,224 @@ static void throwError(const char *format, ...) {
   exit(1);
 }
 
+static const char *getOptionValue(struct tmk_CmdArguments *cmdArguments,
+                                  const char *option, int *offset) {
+  const char *argument = cmdArguments->utf8Arguments[*offset];
+  size_t optionLength = strlen(option);
+  if (strncmp(argument, option, optionLength)) {
+    return NULL;
+  }
+  if (argument[optionLength] == '=') {
+    return argument + optionLength + 1;
+  }
+  if (argument[optionLength]) {
+    return NULL;
+  }
+  if (*offset + 1 == cmdArguments->totalArguments) {
+    throwError("the option \"%s\" needs a value.", option);
+  }
+  return cmdArguments->utf8Arguments[++*offset];
+}
+
+#if !tmk_IS_OPERATING_SYSTEM_WINDOWS
+static void parseTotalWorkers(const char *value) {
+  char *end;
+  unsigned long totalWorkers = strtoul(value, &end, 10);
+  if (!*value || *end || totalWorkers > MAXIMUM_TOTAL_WORKERS) {
+    writeError("the value \"%s\" is not a valid number of jobs. It must be "
+               "between 0 and %d.",
+               value, MAXIMUM_TOTAL_WORKERS);
+    return;
+  }
+  if (!totalWorkers) {
+    long totalProcessors = sysconf(_SC_NPROCESSORS_ONLN);
+    totalWorkers = totalProcessors < 1                       ? 1
+                   : totalProcessors > MAXIMUM_TOTAL_WORKERS ? MAXIMUM_TOTAL_WORKERS
+                                                             : totalProcessors;
+  }
+  totalWorkers_g = totalWorkers;
+}
+
+static void parseCredentialsMode(const char *value) {
+  if (!strcmp(value, "auto")) {
+    credentialsMode_g = CredentialsMode_Automatic;
+  } else if (!strcmp(value, "preload")) {
+    credentialsMode_g = CredentialsMode_Preload;
+  } else if (!strcmp(value, "lookup")) {
+    credentialsMode_g = CredentialsMode_Lookup;
+  } else {
+    writeError("the value \"%s\" is not a valid credentials mode. It must be "
+               "auto, preload or lookup.",
+               value);
+  }
+}
+
+static void parseSortKind(const char *value) {
+  if (!strcmp(value, "name")) {
+    sortKind_g = SortKind_Name;
+  } else if (!strcmp(value, "size")) {
+    sortKind_g = SortKind_Size;
+  } else if (!strcmp(value, "mtime")) {
+    sortKind_g = SortKind_ModifiedTime;
+  } else if (!strcmp(value, "version")) {
+    sortKind_g = SortKind_Version;
+  } else {
+    throwError("the value \"%s\" is not a valid sort. It must be name, size, "
+               "mtime or version.",
+               value);
+  }
+}
+
+static void parseOutputFormat(const char *value) {
+  if (!strcmp(value, "table")) {
+    outputFormat_g = OutputFormat_Table;
+  } else if (!strcmp(value, "jsonl")) {
+    outputFormat_g = OutputFormat_JSONLines;
+  } else if (!strcmp(value, "csv")) {
+    outputFormat_g = OutputFormat_CSV;
+  } else if (!strcmp(value, "tsv")) {
+    outputFormat_g = OutputFormat_TSV;
+  } else if (!strcmp(value, "nul")) {
+    outputFormat_g = OutputFormat_NUL;
+  } else {
+    throwError("the value \"%s\" is not a valid format. It must be table, "
+               "jsonl, csv, tsv or nul.",
+               value);
+  }
+}
+
+static void parseTotalTopEntries(const char *value) {
+  char *end;
+  unsigned long long totalTopEntries = strtoull(value, &end, 10);
+  if (!*value || *end || *value == '-' || !totalTopEntries ||
+      totalTopEntries > SIZE_MAX / sizeof(struct TopEntry)) {
+    throwError("the value \"%s\" is not a valid number of entries. It must "
+               "be greater than 0.",
+               value);
+  }
+  totalTopEntries_g = totalTopEntries;
+}
+
+static void parseMaximumDepth(const char *value) {
+  char *end;
+  unsigned long maximumDepth = strtoul(value, &end, 10);
+  if (!*value || *end || *value == '-' || maximumDepth > INT_MAX) {
+    throwError("the value \"%s\" is not a valid depth. It must be between 0 "
+               "and %d.",
+               value, INT_MAX);
+  }
+  maximumDepth_g = maximumDepth;
+}
+
+static void parseStatsFormat(const char *value) {
+  if (!strcmp(value, "text")) {
+    statsFormat_g = StatsFormat_Text;
+  } else if (!strcmp(value, "json")) {
+    statsFormat_g = StatsFormat_JSON;
+  } else {
+    writeError("the value \"%s\" is not a valid stats format. It must be text "
+               "or json.",
+               value);
+  }
+}
+
+static void parseNamePattern(const char *value, int isExcluding) {
+  /* Patterns are compiled once all options are read, as --regex may follow. */
+  struct NamePattern *patterns = realloc(
+      namePatterns_g, (totalNamePatterns_g + 1) * sizeof(struct NamePattern));
+  if (!patterns) {
+    throwError("can not allocate %zuB of memory on the heap.",
+               (totalNamePatterns_g + 1) * sizeof(struct NamePattern));
+  }
+  namePatterns_g = patterns;
+  namePatterns_g[totalNamePatterns_g++] =
+      (struct NamePattern){.value = value, .isExcluding = isExcluding};
+}
+
+static void parseEntryTypes(const char *value) {
+  /* Types are given by the letters of find, each one setting a bit. */
+  static const char letters[] = "fdlpscb";
+  static const mode_t modes[] = {S_IFREG, S_IFDIR, S_IFLNK, S_IFIFO,
+                                 S_IFSOCK, S_IFCHR, S_IFBLK};
+  unsigned int typesMask = 0;
+  for (const char *cursor = value; *cursor; ++cursor) {
+    const char *letter = *cursor == ',' ? NULL : strchr(letters, *cursor);
+    if (letter) {
+      typesMask |= 1u << IFTODT(modes[letter - letters]);
+    } else if (*cursor != ',') {
+      typesMask = 0;
+      break;
+    }
+  }
+  if (!typesMask) {
+    throwError("the value \"%s\" is not a valid type. It must be made of f, "
+               "d, l, p, s, c or b.",
+               value);
+  }
+  entryTypesMask_g = typesMask;
+}
+
+static void parseMinimumSize(const char *value) {
+  /* Units are resolved once all options are read, as --si may follow. */
+  static const char units[] = "kMGT";
+  char *end;
+  unsigned long long size = strtoull(value, &end, 10);
+  const char *unit = *end ? strchr(units, *end == 'K' ? 'k' : *end) : NULL;
+  if (!*value || *value == '-' || end == value || (*end && !unit) ||
+      (unit && end[1])) {
+    throwError("the value \"%s\" is not a valid size. It must be a number "
+               "of bytes, optionally followed by k, M, G or T.",
+               value);
+  }
+  minimumSize_g = size;
+  minimumSizeExponent_g = unit ? unit - units + 1 : 0;
+  isSizeFiltered_g = 1;
+}
+
+static void parseMinimumAge(const char *value) {
+  static const char units[] = "smhdw";
+  static const unsigned long long unitSeconds[] = {1, 60, 3600, SECONDS_PER_DAY,
+                                                   7 * SECONDS_PER_DAY};
+  char *end;
+  unsigned long long age = strtoull(value, &end, 10);
+  const char *unit = *end ? strchr(units, *end) : units + 3;
+  time_t now = time(NULL);
+  if (!*value || *value == '-' || end == value || !unit || (*end && end[1]) ||
+      age > (unsigned long long)now / unitSeconds[unit - units]) {
+    throwError("the value \"%s\" is not a valid age. It must be a number "
+               "of days, or of s, m, h, d or w when followed by one.",
+               value);
+  }
+  maximumModifiedTime_g = now - (time_t)(age * unitSeconds[unit - units]);
+  isAgeFiltered_g = 1;
+}
+
+static void parseOwner(const char *value) {
+  /* Names are resolved to ids once, so entries are compared by their ids. */
+  char *end;
+  unsigned long id = strtoul(value, &end, 10);
+  if (*value && *value != '-' && !*end && id <= UINT_MAX) {
+    ownerId_g = id;
+    isOwnerFiltered_g = 1;
+    return;
+  }
+  struct passwd *user = getpwnam(value);
+  if (!user) {
+    throwError("the user \"%s\" does not exist.", value);
+  }
+  ownerId_g = user->pw_uid;
+  isOwnerFiltered_g = 1;
+}
+
+static void resolveMinimumSize(void) {
+  for (int exponent = 0; exponent < minimumSizeExponent_g; ++exponent) {
+    minimumSize_g = minimumSize_g > ULLONG_MAX / sizeBase_g
+                        ? ULLONG_MAX
+                        : minimumSize_g * sizeBase_g;
+  }
+}
+#endif
+
 static void writeHelpPage(void) {
   tmk_write("Usage: ");
   tmk_setFontWeight(tmk_FontWeight_Bold);
@@ -804,6 +5514,136 @@ static void writeHelpPage(void) {
   tmk_resetFontWeight();
   tmk_writeLine("    --help        Shows the software help instructions.");
   tmk_writeLine("    --version     Shows the software version.");
+  tmk_writeLine("    --si          Uses powers of 1000 for sizes instead of "
+                "1024.");
+  tmk_writeLine("    --bytes       Shows sizes in exact bytes.");
+#if !tmk_IS_OPERATING_SYSTEM_WINDOWS
+  tmk_writeLine("    --jobs N      Uses N threads to get the metadata of "
+                "entries or, if many");
+  tmk_writeLine("                  directories are given, to read up to N of "
+                "them at once. If N");
+  tmk_writeLine("                  is 0, uses one per processor. Default is 1, "
+                "reading up to 4");
+  tmk_writeLine("                  directories at once.");
+  tmk_writeLine("    --io-uring    Gets the metadata of many entries at once "
+                "using io_uring,");
+  tmk_writeLine("                  when available. Useful for network "
+                "filesystems.");
+  tmk_writeLine("    --credentials MODE");
+  tmk_writeLine("                  Sets how owner names are found: preload "
+                "reads the whole user");
+  tmk_writeLine("                  and group databases at once, lookup asks "
+                "for each owner and");
+  tmk_writeLine("                  auto, the default, preloads after finding "
+                "many owners.");
+  tmk_writeLine("    --sort KEY    Sorts entries by name, the default, size "
+                "or mtime, largest");
+  tmk_writeLine("                  and newest first, or version, ordering "
+                "numbers in names by");
+  tmk_writeLine("                  their values.");
+  tmk_writeLine("    --reverse     Reverses the order of entries.");
+  tmk_writeLine("    --format FMT  Writes entries as table, the default, or as "
+                "jsonl, csv, tsv or");
+  tmk_writeLine("                  nul records of raw values, one for each "
+                "entry. In jsonl, a");
+  tmk_writeLine("                  string that is not UTF-8 is null, with its "
+                "bytes in base64");
+  tmk_writeLine("                  in a field of the same name ending in "
+                "_base64. In nul, each of");
+  tmk_writeLine("                  the 11 fields of a record ends with a null "
+                "character, so");
+  tmk_writeLine("                  records are split by counting fields.");
+  tmk_writeLine("    --top N       Shows only the first N entries in the "
+                "sort order, without");
+  tmk_writeLine("                  keeping the others in memory.");
+  tmk_writeLine("    --stream      Shows entries as they are read, unsorted, "
+                "keeping only a few");
+  tmk_writeLine("                  of them in memory. Columns widen when "
+                "needed. Ignores --sort");
+  tmk_writeLine("                  and --top.");
+  tmk_writeLine("    --recursive   Also shows the contents of each directory "
+                "inside, staying in");
+  tmk_writeLine("                  the filesystem of the directories given and "
+                "not following");
+  tmk_writeLine("                  symlinks. Ignores --stream.");
+  tmk_writeLine("    --depth N     Same as --recursive, but goes at most N "
+                "directories deep.");
+  tmk_writeLine("    --dir-sizes   Shows the total size of everything inside "
+                "each directory,");
+  tmk_writeLine("                  counting files with many links once and "
+                "staying in its");
+  tmk_writeLine("                  filesystem. Uses one thread per processor "
+                "unless --jobs is");
+  tmk_writeLine("                  given.");
+  tmk_writeLine("    --allocated   Shows the space allocated on disk instead "
+                "of sizes.");
+  tmk_writeLine("    --cache       Keeps the entries of each directory listed "
+                "in a cache, in");
+  tmk_writeLine("                  $XDG_CACHE_HOME/dl, reading them from it "
+                "while the directory");
+  tmk_writeLine("                  itself is not changed. Entries changed in "
+                "place, like a file");
+  tmk_writeLine("                  written to, are only noticed after the "
+                "directory changes.");
+  tmk_writeLine("                  Not used with --stream, --top or any "
+                "filter.");
+  tmk_writeLine("    --watch       Keeps showing the first directory given, "
+                "redrawing the rows");
+  tmk_writeLine("                  that change as entries are created, "
+                "removed or changed, until");
+  tmk_writeLine("                  interrupted. Needs Linux. Ignores --stream, "
+                "--top, --recursive");
+  tmk_writeLine("                  and --dir-sizes.");
+  tmk_writeLine("    --stats[=FMT] Writes to stderr, at exit, the time spent "
+                "reading directories,");
+  tmk_writeLine("                  getting metadata, reading symlinks, "
+                "finding owners, sorting,");
+  tmk_writeLine("                  rendering and writing, summed over all "
+                "threads, with the system");
+  tmk_writeLine("                  calls each made: getdents64, statx, "
+                "fstatat or io_uring_enter,");
+  tmk_writeLine("                  readlinkat, lookups in the user and group "
+                "databases and write.");
+  tmk_writeLine("                  Also shows owner lookup hits and the peak "
+                "use of each memory");
+  tmk_writeLine("                  arena. FMT is text, the default, or json.");
+  tmk_writeLine("    --include PATTERN");
+  tmk_writeLine("                  Shows only entries whose names match "
+                "PATTERN, a glob like");
+  tmk_writeLine("                  \"*.log\". Can be given many times, "
+                "keeping entries matching");
+  tmk_writeLine("                  any. Names are matched as they are read, "
+                "so entries left out");
+  tmk_writeLine("                  cost no metadata and their directories are "
+                "not walked.");
+  tmk_writeLine("    --exclude PATTERN");
+  tmk_writeLine("                  Hides entries whose names match PATTERN, "
+                "even if included.");
+  tmk_writeLine("    --regex       Reads the patterns as POSIX extended "
+                "regular expressions,");
+  tmk_writeLine("                  matching anywhere in names unless "
+                "anchored.");
+  tmk_writeLine("    --type TYPES  Shows only entries of the types given, "
+                "as letters: regular");
+  tmk_writeLine("                  (f), directory (d), symlink (l), fifo (p), "
+                "socket (s),");
+  tmk_writeLine("                  character device (c) or block device (b). "
+                "Checked before");
+  tmk_writeLine("                  getting metadata when the filesystem "
+                "reports types.");
+  tmk_writeLine("    --larger N    Shows only entries larger than N bytes, or "
+                "than N of the unit");
+  tmk_writeLine("                  given after it: k, M, G or T. Directories "
+                "are never larger.");
+  tmk_writeLine("    --older N     Shows only entries last modified more than "
+                "N days ago, or N of");
+  tmk_writeLine("                  the unit given after it: s, m, h, d or "
+                "w.");
+  tmk_writeLine("    --owner USER  Shows only entries owned by USER, a name or "
+                "an id. As with");
+  tmk_writeLine("                  --include, directories left out are not "
+                "walked.");
+#endif
 }
 
 static void writeVersionPage(void) {
@@ -835,6 +5675,57 @@ static void *allocateHeapMemory(size_t totalBytes) {
   return NULL;
 }
 
+static struct ArenaBlock *allocateArenaBlock(size_t unit, size_t capacity) {
+  if (capacity > (SIZE_MAX - ARENA_BLOCK_HEADER_SIZE) / unit) {
+    throwError("can not allocate an arena block of %zu items of %zuB.",
+               capacity, unit);
+  }
+  size_t totalBytes = ARENA_BLOCK_HEADER_SIZE + capacity * unit;
+  struct ArenaBlock *block;
+#if tmk_IS_OPERATING_SYSTEM_WINDOWS
+  block = allocateHeapMemory(totalBytes);
+  block->mappingSize = 0;
+#else
+  /* Big blocks are mapped, so their pages are returned once freed. */
+  if (totalBytes >= ARENA_MAPPING_THRESHOLD) {
+    block = mmap(NULL, totalBytes, PROT_READ | PROT_WRITE,
+                 MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (block == MAP_FAILED) {
+      throwError("can not map %zuB of memory.", totalBytes);
+    }
+#if USE_HUGE_PAGES && defined(MADV_HUGEPAGE)
+    if (totalBytes >= HUGE_PAGE_SIZE) {
+      madvise(block, totalBytes, MADV_HUGEPAGE);
+    }
+#endif
+    block->mappingSize = totalBytes;
+  } else {
+    block = allocateHeapMemory(totalBytes);
+    block->mappingSize = 0;
+  }
+#endif
+  block->previous = NULL;
+  block->buffer = (char *)block + ARENA_BLOCK_HEADER_SIZE;
+  block->use = 0;
+  block->capacity = capacity;
+  return block;
+}
+
+static void freeArenaBlock(struct ArenaBlock *block) {
+  if (!block) {
+    return;
+  }
+#if tmk_IS_OPERATING_SYSTEM_WINDOWS
+  free(block);
+#else
+  if (block->mappingSize) {
+    munmap(block, block->mappingSize);
+  } else {
+    free(block);
+  }
+#endif
+}
+
 static void createArenaAllocator(const char *name, size_t unit, size_t capacity,
                                  struct ArenaAllocator **allocator) {
   if (*allocator) {
@@ -844,27 +5735,83 @@ static void createArenaAllocator(const char *name, size_t unit, size_t capacity,
   size_t nameSize = strlen(name) + 1;
   (*allocator)->name = allocateHeapMemory(nameSize);
   memcpy((*allocator)->name, name, nameSize);
-  (*allocator)->buffer = allocateHeapMemory(capacity * unit);
+  (*allocator)->block = allocateArenaBlock(unit, capacity);
+  (*allocator)->spareBlock = NULL;
   (*allocator)->capacity = capacity;
+  (*allocator)->nextBlockCapacity = 0;
   (*allocator)->unit = unit;
   (*allocator)->use = 0;
+  (*allocator)->peakUse = 0;
+  (*allocator)->peakCapacity = capacity;
 }
 
 static void *allocateArenaMemory(struct ArenaAllocator *allocator,
                                  size_t totalAllocations) {
-  if (allocator->buffer +
-          (allocator->use + totalAllocations) * allocator->unit >
-      allocator->buffer + allocator->capacity * allocator->unit) {
-    throwError("can not allocate %zu items (%zuB) in the allocator \"%s\".",
-               totalAllocations, totalAllocations * allocator->unit,
-               allocator->name);
+  struct ArenaBlock *block = allocator->block;
+  if (block->use + totalAllocations > block->capacity) {
+    /* Blocks only move when compacted, so pointers stay valid until then. */
+    size_t capacity = block->capacity * 2;
+    SAVE_GREATER(capacity, allocator->nextBlockCapacity);
+    SAVE_GREATER(capacity, totalAllocations);
+    if (allocator->spareBlock &&
+        allocator->spareBlock->capacity >= totalAllocations) {
+      block = allocator->spareBlock;
+      allocator->spareBlock = NULL;
+    } else {
+      block = allocateArenaBlock(allocator->unit, capacity);
+      allocator->capacity += capacity;
+      allocator->nextBlockCapacity = 0;
+      SAVE_GREATER(allocator->peakCapacity, allocator->capacity);
+    }
+    block->previous = allocator->block;
+    allocator->block = block;
   }
-  void *allocation = allocator->buffer + allocator->use * allocator->unit;
+  void *allocation = block->buffer + block->use * allocator->unit;
+  block->use += totalAllocations;
   allocator->use += totalAllocations;
   return allocation;
 }
 
+static void *compactArenaAllocator(struct ArenaAllocator *allocator) {
+  /* Moves all items to a new block, so pointers given before are invalid. */
+  if (!allocator->block->previous) {
+    return allocator->block->buffer;
+  }
+  if (allocator->spareBlock) {
+    allocator->capacity -= allocator->spareBlock->capacity;
+    freeArenaBlock(allocator->spareBlock);
+    allocator->spareBlock = NULL;
+  }
+  struct ArenaBlock *compactBlock =
+      allocateArenaBlock(allocator->unit, allocator->use);
+  compactBlock->use = allocator->use;
+  allocator->nextBlockCapacity = allocator->block->capacity * 2;
+  char *end = compactBlock->buffer + allocator->use * allocator->unit;
+  for (struct ArenaBlock *block = allocator->block, *previous; block;
+       block = previous) {
+    previous = block->previous;
+    end -= block->use * allocator->unit;
+    memcpy(end, block->buffer, block->use * allocator->unit);
+    freeArenaBlock(block);
+  }
+  allocator->block = compactBlock;
+  allocator->capacity = allocator->use;
+  return compactBlock->buffer;
+}
+
 static void resetArenaAllocator(struct ArenaAllocator *allocator) {
+  /* Keeps the newest block for the next use, saving the peak here. */
+  SAVE_GREATER(allocator->peakUse, allocator->use);
+  for (struct ArenaBlock *block = allocator->block->previous, *previous; block;
+       block = previous) {
+    previous = block->previous;
+    freeArenaBlock(block);
+  }
+  freeArenaBlock(allocator->spareBlock);
+  allocator->spareBlock = NULL;
+  allocator->block->previous = NULL;
+  allocator->block->use = 0;
+  allocator->capacity = allocator->block->capacity;
   allocator->use = 0;
 }
 
@@ -875,14 +5822,36 @@ static void freeArenaMemory(struct ArenaAllocator *allocator,
                totalAllocations, totalAllocations * allocator->unit,
                allocator->name);
   }
+  SAVE_GREATER(allocator->peakUse, allocator->use);
   allocator->use -= totalAllocations;
+  while (totalAllocations > allocator->block->use) {
+    struct ArenaBlock *block = allocator->block;
+    totalAllocations -= block->use;
+    allocator->block = block->previous;
+    block->previous = NULL;
+    block->use = 0;
+    if (allocator->spareBlock) {
+      allocator->capacity -= allocator->spareBlock->capacity;
+      freeArenaBlock(allocator->spareBlock);
+    }
+    allocator->spareBlock = block;
+  }
+  allocator->block->use -= totalAllocations;
 }
 
 static void freeArenaAllocator(struct ArenaAllocator *allocator) {
   if (!allocator) {
     return;
   }
-  free(allocator->buffer);
+#if !tmk_IS_OPERATING_SYSTEM_WINDOWS
+  saveArenaStats(allocator);
+#endif
+  for (struct ArenaBlock *block = allocator->block, *previous; block;
+       block = previous) {
+    previous = block->previous;
+    freeArenaBlock(block);
+  }
+  freeArenaBlock(allocator->spareBlock);
   free(allocator->name);
   free(allocator);
 }
@@ -890,33 +5859,129 @@ static void freeArenaAllocator(struct ArenaAllocator *allocator) {
 int main(int totalRawCMDArguments, const char **rawCMDArguments) {
   struct tmk_CmdArguments cmdArguments;
   tmk_getCmdArguments(totalRawCMDArguments, rawCMDArguments, &cmdArguments);
-  if (cmdArguments.totalArguments == 1) {
-#if defined(_WIN32)
-    readDirectory(".", L".");
-#else
-    readDirectory(".");
-#endif
-    goto end_l;
-  }
   for (int offset = 1; offset < cmdArguments.totalArguments; ++offset) {
     PARSE_OPTION("help", writeHelpPage());
     PARSE_OPTION("version", writeVersionPage());
   }
+#if !tmk_IS_OPERATING_SYSTEM_WINDOWS
+  isOutputColored_g = !tmk_isStreamRedirected(tmk_Stream_Output);
+  /* Overrides the system databases, mainly for testing. */
+  userCredentialsTable_g.databasePath = getenv("DL_PASSWD_FILE");
+  groupCredentialsTable_g.databasePath = getenv("DL_GROUP_FILE");
+#endif
+  int *directoryOffsets =
+      allocateHeapMemory(cmdArguments.totalArguments * sizeof(int));
+  int totalDirectories = 0;
   for (int offset = 1; offset < cmdArguments.totalArguments; ++offset) {
     if (cmdArguments.utf8Arguments[offset][0] == '-' &&
         cmdArguments.utf8Arguments[offset][1] == '-') {
+      PARSE_FLAG("si", sizeBase_g = 1000);
+      PARSE_FLAG("bytes", isSizeExact_g = 1);
+#if !tmk_IS_OPERATING_SYSTEM_WINDOWS
+      const char *optionValue;
+      PARSE_FLAG("io-uring", isIOURingEnabled_g = 1);
+      PARSE_VALUE_OPTION("jobs", parseTotalWorkers(optionValue));
+      PARSE_VALUE_OPTION("credentials", parseCredentialsMode(optionValue));
+      PARSE_VALUE_OPTION("sort", parseSortKind(optionValue));
+      PARSE_FLAG("reverse", isSortReversed_g = 1);
+      PARSE_VALUE_OPTION("format", parseOutputFormat(optionValue));
+      PARSE_VALUE_OPTION("top", parseTotalTopEntries(optionValue));
+      PARSE_FLAG("stream", isStreaming_g = 1);
+      PARSE_FLAG("recursive", maximumDepth_g = INT_MAX);
+      PARSE_VALUE_OPTION("depth", parseMaximumDepth(optionValue));
+      PARSE_FLAG("dir-sizes", isMeasuringDirectories_g = 1);
+      PARSE_FLAG("allocated", isSizeAllocated_g = 1);
+      PARSE_FLAG("cache", isCaching_g = 1);
+      PARSE_FLAG("watch", isWatching_g = 1);
+      PARSE_FLAG("stats", statsFormat_g = StatsFormat_Text);
+      PARSE_VALUE_OPTION("stats", parseStatsFormat(optionValue));
+      PARSE_VALUE_OPTION("include", parseNamePattern(optionValue, 0));
+      PARSE_VALUE_OPTION("exclude", parseNamePattern(optionValue, 1));
+      PARSE_FLAG("regex", isNameRegex_g = 1);
+      PARSE_VALUE_OPTION("type", parseEntryTypes(optionValue));
+      PARSE_VALUE_OPTION("larger", parseMinimumSize(optionValue));
+      PARSE_VALUE_OPTION("older", parseMinimumAge(optionValue));
+      PARSE_VALUE_OPTION("owner", parseOwner(optionValue));
+#endif
       writeError("the option \"%s\" does not exists. Use --help for help instructions.",
                  cmdArguments.utf8Arguments[offset]);
       continue;
     }
+    directoryOffsets[totalDirectories++] = offset;
+  }
+#if !tmk_IS_OPERATING_SYSTEM_WINDOWS
+  if (statsFormat_g) {
+    stats_g.startTime = readStatsClock(CLOCK_MONOTONIC);
+  }
+  compileNamePatterns();
+  resolveMinimumSize();
+  if (isStreaming_g) {
+    /* Entries are written unsorted, so there are no first ones to keep. */
+    totalTopEntries_g = 0;
+  }
+  if (isWatching_g) {
+    /* Entries added later could not be measured. */
+    totalTopEntries_g = 0;
+    maximumDepth_g = 0;
+    isMeasuringDirectories_g = 0;
+  }
+  if (isMeasuringDirectories_g && sortKind_g == SortKind_Size) {
+    /* Directories have no size to be ranked by until they are measured. */
+    totalMeasuredTopEntries_g = totalTopEntries_g;
+    totalTopEntries_g = 0;
+  }
+  if (isCaching_g) {
+    createCacheDirectory();
+  }
+  if (outputFormat_g != OutputFormat_Table) {
+    /* Values are written raw, so there is nothing to color. */
+    isOutputColored_g = 0;
+  }
+  if (outputFormat_g == OutputFormat_CSV) {
+    recordsHeader_g =
+        "directory,name,type,size,mtime,mode,uid,user,gid,group,link\n";
+  } else if (outputFormat_g == OutputFormat_TSV) {
+    recordsHeader_g = "directory\tname\ttype\tsize\tmtime\tmode\tuid\tuser"
+                      "\tgid\tgroup\tlink\n";
+  }
+#endif
+  if (!totalDirectories && !exitCode_g) {
 #if defined(_WIN32)
-    readDirectory(cmdArguments.utf8Arguments[offset],
-                  cmdArguments.utf16Arguments[offset]);
+    readDirectory(".", L".");
 #else
-    readDirectory(cmdArguments.utf8Arguments[offset]);
+    if (isWatching_g) {
+      watchDirectory(".");
+    } else if (maximumDepth_g) {
+      walkTrees(&cmdArguments, directoryOffsets, 0);
+    } else if (isStreaming_g) {
+      streamDirectory(".");
+    } else {
+      readDirectory(".");
+    }
 #endif
   }
-end_l:
+#if defined(_WIN32)
+  for (int index = 0; index < totalDirectories; ++index) {
+    readDirectory(cmdArguments.utf8Arguments[directoryOffsets[index]],
+                  cmdArguments.utf16Arguments[directoryOffsets[index]]);
+  }
+#else
+  if (isWatching_g && totalDirectories) {
+    /* Only the first directory given is watched. */
+    watchDirectory(cmdArguments.utf8Arguments[*directoryOffsets]);
+  } else if (maximumDepth_g && totalDirectories) {
+    walkTrees(&cmdArguments, directoryOffsets, totalDirectories);
+  } else if (isStreaming_g) {
+    for (int index = 0; index < totalDirectories; ++index) {
+      streamDirectory(cmdArguments.utf8Arguments[directoryOffsets[index]]);
+    }
+  } else if (totalDirectories == 1) {
+    readDirectory(cmdArguments.utf8Arguments[*directoryOffsets]);
+  } else if (totalDirectories) {
+    readDirectories(&cmdArguments, directoryOffsets, totalDirectories);
+  }
+#endif
+  free(directoryOffsets);
 #if DEBUG
   tmk_writeLine("");
   tmk_writeLine("Running in debug mode...");
@@ -947,9 +6012,20 @@ end_l:
   freeArenaAllocator(userCredentialsDataAllocator_g);
   freeArenaAllocator(groupCredentialsAllocator_g);
   freeArenaAllocator(groupCredentialsDataAllocator_g);
+  freeCredentialTable(&userCredentialsTable_g);
+  freeCredentialTable(&groupCredentialsTable_g);
+  freeWorkers();
+  freeSizeWalk();
+  freeNamePatterns();
+  free(cacheDirectoryPath_g);
 #endif
   freeArenaAllocator(entriesAllocator_g);
   freeArenaAllocator(entriesDataAllocator_g);
   freeArenaAllocator(temporaryDataAllocator_g);
+#if !tmk_IS_OPERATING_SYSTEM_WINDOWS
+  if (statsFormat_g) {
+    writeStats();
+  }
+#endif
   return exitCode_g;
 }